@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace bench {
+using clock = std::chrono::steady_clock;
+
+inline double to_ms(clock::duration time) noexcept {
+  return std::chrono::duration<double, std::milli>(time).count();
+}
+
+/**\return value, which is greater then the part of values
+ * \warning values must be sorted
+ */
+inline double percentile(const std::vector<double> &values,
+                         double                     part) noexcept {
+  if (values.empty()) {
+    return 0;
+  }
+
+  size_t index = static_cast<size_t>(part * values.size());
+  return values[std::min(index, values.size() - 1)];
+}
+
+inline void print_header() noexcept {
+  printf("%-24s %8s %10s %10s %10s %10s\n",
+         "name(ms)",
+         "count",
+         "mean",
+         "p50",
+         "p99",
+         "max");
+}
+
+/**\brief print count, mean, p50, p99 and max of the values
+ */
+inline void print_stats(const std::string &name, std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+
+  double summ = 0;
+  for (double value : values) {
+    summ += value;
+  }
+
+  printf("%-24s %8zu %10.3f %10.3f %10.3f %10.3f\n",
+         name.c_str(),
+         values.size(),
+         values.empty() ? 0. : summ / values.size(),
+         percentile(values, 0.5),
+         percentile(values, 0.99),
+         values.empty() ? 0. : values.back());
+}
+
+/**\return false if file can not be readen
+ */
+inline bool read_file(const char *filename, std::string &content) {
+  std::ifstream file{filename};
+  if (file.is_open() == false) {
+    return false;
+  }
+
+  std::stringstream stream;
+  stream << file.rdbuf();
+  content = stream.str();
+  return true;
+}
+
+/**\return "c" for files with .c extension, otherwise "cpp"
+ */
+inline const char *get_buf_type(const std::string &filename) noexcept {
+  size_t size = filename.size();
+  return size > 2 && filename.compare(size - 2, 2, ".c") == 0 ? "c" : "cpp";
+}
+} // namespace bench
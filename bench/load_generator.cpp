@@ -0,0 +1,346 @@
+// load generator, which replays keystroke-like edits of files against
+// running hl-server by several connections
+
+#include "bench_stats.hpp"
+#include "c_arg_parser/arg_parser.h"
+#include "c_logs/log.h"
+#include "text_edit.hpp"
+#include <arpa/inet.h>
+#include <iostream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+
+#define ADDRESS   "127.0.0.1"
+#define DELIMITER '\n'
+
+
+using nlohmann::json;
+
+struct load_options {
+  const char *address;
+  int         port;
+  int         requests; // for every connection
+  int         interval; // ms between requests
+  bool        use_edits;
+  std::string flags;
+};
+
+struct load_results {
+  std::mutex          mutex;
+  std::vector<double> latencies;
+  size_t              errors;
+};
+
+/**\brief send requests for the file by one connection and wait response for
+ * every request
+ */
+static void run_connection(int                 index,
+                           const std::string & filename,
+                           const load_options &options,
+                           load_results &      results);
+
+/**\return connected socket, or -1 in case of error
+ */
+static int connect_to(const char *address, int port) noexcept;
+
+static bool send_all(int sock, const std::string &data) noexcept;
+
+/**\brief read one delimited message to line
+ */
+static bool receive_line(int sock, std::string &buf, std::string &line);
+
+
+int main(int argc, char *argv[]) {
+  LOGGER_ADD_STDERR_SINK(log_default_format,
+                         LogFailure | LogError | LogWarning);
+
+  arg_parser *parser = arg_parser_make(
+      "hl-load sends keystroke-like edits of files to running hl-server:");
+
+  ARG_PARSER_ADD_BOOL(parser, "help", 'h', "print help", false);
+  ARG_PARSER_ADD_INTD(parser, "port", 'p', "port of server", 53827);
+  ARG_PARSER_ADD_STR(parser,
+                     "address",
+                     'a',
+                     "address of server: IPv4 (127.0.0.1 by default), IPv6 or "
+                     "path of unix domain socket",
+                     false);
+  ARG_PARSER_ADD_INTD(parser, "connections", 'c', "count of connections", 4);
+  ARG_PARSER_ADD_INTD(parser,
+                      "requests",
+                      'n',
+                      "count of requests for every connection",
+                      100);
+  ARG_PARSER_ADD_INTD(parser,
+                      "interval",
+                      0,
+                      "interval between requests in ms",
+                      0);
+  ARG_PARSER_ADD_BOOLD(parser,
+                       "edits",
+                       0,
+                       "send edits (protocol v1.4) instead of full buffers",
+                       false);
+  ARG_PARSER_ADD_STR(parser, "file", 0, "file for edits", true);
+  ARG_PARSER_ADD_STR(parser, "flag", 0, "compilation flags", false);
+
+  char *                   err        = nullptr;
+  int                      result     = 0;
+  bool                     need_help  = false;
+  int                      conn_count = 0;
+  int                      file_count = 0;
+  int                      flag_count = 0;
+  const char **            files      = NULL;
+  const char **            flags      = NULL;
+  load_options             options;
+  load_results             results;
+  std::vector<std::thread> threads;
+  bench::clock::time_point start;
+  double                   elapsed = 0;
+
+  result = ARG_PARSER_PARSE(parser, argc, argv, false, false, &err);
+  if (ARG_PARSER_GET_BOOL(parser, "help", need_help) && need_help) {
+    char *usage = arg_parser_usage(parser);
+    std::cout << usage;
+    free(usage);
+    goto Finish;
+  }
+  if (result != 0) {
+    LOG_ERROR("error during argument parsing: %s", err);
+    result = EXIT_FAILURE;
+    goto Finish;
+  }
+
+  options.address = ADDRESS;
+  ARG_PARSER_GET_STR(parser, "address", options.address);
+  ARG_PARSER_GET_INT(parser, "port", options.port);
+  ARG_PARSER_GET_INT(parser, "connections", conn_count);
+  ARG_PARSER_GET_INT(parser, "requests", options.requests);
+  ARG_PARSER_GET_INT(parser, "interval", options.interval);
+  ARG_PARSER_GET_BOOL(parser, "edits", options.use_edits);
+
+  file_count = arg_parser_count(parser, "file");
+  files      = new const char *[file_count];
+  arg_parser_get_args(parser, "file", ArgString, files, file_count);
+
+  flag_count = arg_parser_count(parser, "flag");
+  if (flag_count > 0) {
+    flags = new const char *[flag_count];
+    arg_parser_get_args(parser, "flag", ArgString, flags, flag_count);
+  }
+  for (int i = 0; i < flag_count; ++i) {
+    options.flags += i == 0 ? "" : "\n";
+    options.flags += flags[i];
+  }
+
+  results.errors = 0;
+  start          = bench::clock::now();
+  for (int i = 0; i < conn_count && file_count > 0; ++i) {
+    threads.emplace_back(run_connection,
+                         i,
+                         std::string{files[i % file_count]},
+                         std::cref(options),
+                         std::ref(results));
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  elapsed = bench::to_ms(bench::clock::now() - start) / 1000.;
+
+  printf("connections: %d, responses: %zu, errors: %zu, time: %.2fs, "
+         "throughput: %.1f req/s\n",
+         conn_count,
+         results.latencies.size(),
+         results.errors,
+         elapsed,
+         elapsed > 0 ? results.latencies.size() / elapsed : 0.);
+  bench::print_header();
+  bench::print_stats("latency", results.latencies);
+
+
+Finish:
+  if (files) {
+    delete[] files;
+  }
+  if (flags) {
+    delete[] flags;
+  }
+  if (err) {
+    free(err);
+  }
+  arg_parser_dispose(parser);
+  LOGGER_SHUTDOWN();
+  return result;
+}
+
+
+static void run_connection(int                 index,
+                           const std::string & filename,
+                           const load_options &options,
+                           load_results &      results) {
+  std::string         body;
+  std::string         buf;
+  std::string         line;
+  std::vector<double> latencies;
+  size_t              errors     = 0;
+  int                 sock       = -1;
+  size_t              line_count = 1;
+
+  // same edits for every run
+  std::minstd_rand random{static_cast<unsigned int>(index + 1)};
+
+  if (bench::read_file(filename.c_str(), body) == false) {
+    LOG_ERROR("can't read file: %s", filename.c_str());
+    return;
+  }
+  for (char ch : body) {
+    line_count += ch == '\n';
+  }
+
+  sock = connect_to(options.address, options.port);
+  if (sock < 0) {
+    return;
+  }
+
+  for (int i = 0; i < options.requests; ++i) {
+    // keystroke is emulated by inserting of space at begin of some line, so
+    // code stays valid
+    hl::text_edit edit;
+    edit.begin_line   = random() % line_count + 1;
+    edit.begin_column = 1;
+    edit.end_line     = edit.begin_line;
+    edit.end_column   = 1;
+    edit.text         = " ";
+    hl::apply_edits(body, hl::text_edit_list{edit});
+
+    json request_body = {
+        {"version", options.use_edits ? "v1.4" : "v1.2"},
+        {"id", "hl-load-" + std::to_string(index)},
+        {"buf_type", bench::get_buf_type(filename)},
+        {"buf_name", filename},
+        {"additional_info", options.flags},
+    };
+    if (options.use_edits && i != 0) {
+      request_body["edits"] = json::array({{
+          {"begin_line", edit.begin_line},
+          {"begin_column", edit.begin_column},
+          {"end_line", edit.end_line},
+          {"end_column", edit.end_column},
+          {"text", edit.text},
+      }});
+    } else {
+      request_body["buf_body"] = body;
+    }
+    std::string request = json::array({i, request_body}).dump() + DELIMITER;
+
+    bench::clock::time_point start = bench::clock::now();
+    if (send_all(sock, request) == false ||
+        receive_line(sock, buf, line) == false) {
+      LOG_ERROR("connection %d lost", index);
+      break;
+    }
+    latencies.emplace_back(bench::to_ms(bench::clock::now() - start));
+
+    try {
+      json response = json::parse(line);
+      if (response.at(1).at("return_code") != 0) {
+        ++errors;
+      }
+    } catch (std::exception &e) {
+      ++errors;
+    }
+
+    if (options.interval > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{options.interval});
+    }
+  }
+
+  close(sock);
+
+  std::lock_guard<std::mutex> lock{results.mutex};
+  results.latencies.insert(results.latencies.end(),
+                           latencies.begin(),
+                           latencies.end());
+  results.errors += errors;
+}
+
+static int connect_to(const char *address, int port) noexcept {
+  sockaddr_storage addr;
+  socklen_t        addr_len = 0;
+  sockaddr_in *    addr_in  = reinterpret_cast<sockaddr_in *>(&addr);
+  sockaddr_in6 *   addr_in6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+  sockaddr_un *    addr_un  = reinterpret_cast<sockaddr_un *>(&addr);
+
+  memset(&addr, 0, sizeof(addr));
+  if (strchr(address, '/') != nullptr &&
+      strlen(address) < sizeof(addr_un->sun_path)) {
+    addr_un->sun_family = AF_UNIX;
+    strcpy(addr_un->sun_path, address);
+    addr_len = sizeof(sockaddr_un);
+  } else if (inet_pton(AF_INET, address, &addr_in->sin_addr) == 1) {
+    addr_in->sin_family = AF_INET;
+    addr_in->sin_port   = htons(port);
+    addr_len            = sizeof(sockaddr_in);
+  } else if (inet_pton(AF_INET6, address, &addr_in6->sin6_addr) == 1) {
+    addr_in6->sin6_family = AF_INET6;
+    addr_in6->sin6_port   = htons(port);
+    addr_len              = sizeof(sockaddr_in6);
+  } else {
+    LOG_ERROR("invalid address: %s", address);
+    return -1;
+  }
+
+  int sock = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (sock < 0 || connect(sock, (sockaddr *)&addr, addr_len) != 0) {
+    LOG_ERROR("can't connect to server: %s", strerror(errno));
+    if (sock >= 0) {
+      close(sock);
+    }
+    return -1;
+  }
+
+  return sock;
+}
+
+static bool send_all(int sock, const std::string &data) noexcept {
+  size_t written = 0;
+  while (written != data.size()) {
+    ssize_t count = write(sock, data.data() + written, data.size() - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0) {
+      return false;
+    }
+
+    written += count;
+  }
+
+  return true;
+}
+
+static bool receive_line(int sock, std::string &buf, std::string &line) {
+  char chunk[64 * 1024];
+  while (true) {
+    size_t found = buf.find(DELIMITER);
+    if (found != std::string::npos) {
+      line.assign(buf, 0, found);
+      buf.erase(0, found + 1);
+      return true;
+    }
+
+    ssize_t count = read(sock, chunk, sizeof(chunk));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count <= 0) {
+      return false;
+    }
+
+    buf.append(chunk, count);
+  }
+}
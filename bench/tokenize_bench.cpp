@@ -0,0 +1,169 @@
+// micro-benchmarks for tokenization and serialization of responses
+
+#include "bench_stats.hpp"
+#include "c_arg_parser/arg_parser.h"
+#include "c_logs/log.h"
+#include "clang_tokenize.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "tu_cache.hpp"
+#include <iostream>
+
+
+/**\brief run benchmarks for one file
+ *
+ * \return false in case of tokenization error
+ */
+static bool bench_file(const char * filename,
+                       int          iterations,
+                       int          argc,
+                       const char **argv);
+
+
+int main(int argc, char *argv[]) {
+  LOGGER_ADD_STDERR_SINK(log_default_format,
+                         LogFailure | LogError | LogWarning);
+
+  arg_parser *parser = arg_parser_make(
+      "hl-bench runs tokenization and serialization benchmarks for files:");
+
+  ARG_PARSER_ADD_BOOL(parser, "help", 'h', "print help", false);
+  ARG_PARSER_ADD_INTD(parser,
+                      "iterations",
+                      'n',
+                      "count of iterations for every benchmark",
+                      10);
+  ARG_PARSER_ADD_STR(parser, "file", 0, "file for tokenization", true);
+  ARG_PARSER_ADD_STR(parser, "flag", 0, "compilation flags", false);
+
+  char *        err        = nullptr;
+  int           result     = 0;
+  bool          need_help  = false;
+  int           iterations = 0;
+  int           file_count = 0;
+  int           flag_count = 0;
+  const char ** files      = NULL;
+  const char ** flags      = NULL;
+  bool          ok         = true;
+
+  result = ARG_PARSER_PARSE(parser, argc, argv, false, false, &err);
+  if (ARG_PARSER_GET_BOOL(parser, "help", need_help) && need_help) {
+    char *usage = arg_parser_usage(parser);
+    std::cout << usage;
+    free(usage);
+    goto Finish;
+  }
+  if (result != 0) {
+    LOG_ERROR("error during argument parsing: %s", err);
+    ok = false;
+    goto Finish;
+  }
+
+  ARG_PARSER_GET_INT(parser, "iterations", iterations);
+  iterations = iterations > 0 ? iterations : 1;
+
+  file_count = arg_parser_count(parser, "file");
+  files      = new const char *[file_count];
+  arg_parser_get_args(parser, "file", ArgString, files, file_count);
+
+  flag_count = arg_parser_count(parser, "flag");
+  if (flag_count > 0) {
+    flags = new const char *[flag_count];
+    arg_parser_get_args(parser, "flag", ArgString, flags, flag_count);
+  }
+
+  // internal stages of tokenization are taken from metrics
+  hl::metrics::init();
+
+  bench::print_header();
+  for (int i = 0; i < file_count; ++i) {
+    ok = bench_file(files[i], iterations, flag_count, flags) && ok;
+  }
+
+  std::cout << std::endl << hl::metrics::report();
+
+
+Finish:
+  if (files) {
+    delete[] files;
+  }
+  if (flags) {
+    delete[] flags;
+  }
+  if (err) {
+    free(err);
+  }
+  arg_parser_dispose(parser);
+  LOGGER_SHUTDOWN();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static bool bench_file(const char * filename,
+                       int          iterations,
+                       int          argc,
+                       const char **argv) {
+  std::string body;
+  if (bench::read_file(filename, body) == false) {
+    LOG_ERROR("can't read file: %s", filename);
+    return false;
+  }
+
+  std::vector<double> tokenize_times;
+  std::vector<double> reparse_times;
+  std::vector<double> json_times;
+  std::vector<double> msgpack_times;
+  hl::tu_cache        cache;
+  hl::response        resp;
+  std::string         out;
+  std::string         err;
+
+  // new translation unit for every call
+  for (int i = 0; i < iterations; ++i) {
+    bench::clock::time_point start = bench::clock::now();
+    resp.tokens = hl::clang_tokenize(filename, body, argc, argv, err);
+    tokenize_times.emplace_back(bench::to_ms(bench::clock::now() - start));
+
+    if (err.empty() == false) {
+      LOG_ERROR("error from tokenizer for %s: %s", filename, err.c_str());
+      return false;
+    }
+  }
+
+  // first call creates translation unit, so it is not counted
+  hl::clang_tokenize(cache, filename, body, argc, argv, err);
+  for (int i = 0; i < iterations; ++i) {
+    bench::clock::time_point start = bench::clock::now();
+    resp.tokens = hl::clang_tokenize(cache, filename, body, argc, argv, err);
+    reparse_times.emplace_back(bench::to_ms(bench::clock::now() - start));
+  }
+
+  resp.message_number = 0;
+  resp.version        = "v1.2";
+  resp.id             = "bench";
+  resp.buf_type       = bench::get_buf_type(filename);
+  resp.buf_name       = filename;
+  resp.return_code    = 0;
+  resp.diff_mode      = false;
+  resp.is_diff        = false;
+  resp.lexical_mode   = false;
+  resp.lexical        = false;
+  for (int i = 0; i < iterations; ++i) {
+    out.clear();
+    bench::clock::time_point start = bench::clock::now();
+    hl::serialize_response(resp, out);
+    json_times.emplace_back(bench::to_ms(bench::clock::now() - start));
+
+    out.clear();
+    start = bench::clock::now();
+    hl::serialize_msgpack_response(resp, out);
+    msgpack_times.emplace_back(bench::to_ms(bench::clock::now() - start));
+  }
+
+  printf("%s: %zu tokens\n", filename, resp.tokens.size());
+  bench::print_stats("  tokenize", tokenize_times);
+  bench::print_stats("  reparse", reparse_times);
+  bench::print_stats("  serialize json", json_times);
+  bench::print_stats("  serialize msgpack", msgpack_times);
+  return true;
+}
@@ -1,12 +1,119 @@
 #pragma once
 
+#include "hash.hpp"
 #include "token.hpp"
+#include "tu_cache.hpp"
+#include <chrono>
+#include <functional>
 #include <string>
+#include <vector>
 
 
 namespace hl {
+/**\brief called between stages of tokenization, if returns true, then
+ * tokenization stops with error
+ */
+using cancel_callback = std::function<bool()>;
+
+struct tokenize_options {
+  tokenize_options() noexcept;
+
+  // lines (starting from 1) of range for tokenization, all lines of the
+  // range are included. 0 means begin (or end) of the file
+  unsigned int begin_line;
+  unsigned int end_line;
+
+  cancel_callback cancel;
+
+  // annotate only lines, which could be changed since previous tokenization
+  // of whole buffer, tokens of other lines are taken from previous result
+  bool incremental;
+
+  // if not nullptr, then filled by files included by translation unit, but
+  // only if translation unit was created (not reparsed) by the request
+  std::vector<std::string> *includes;
+
+  // if not nullptr, then filled by all files included by translation unit
+  // with their modification times, when libclang read them
+  hl::file_stamp *dependencies;
+
+  // count of concurrent parses is limited (see hl::parse_limit). Slot is
+  // taken after taking of translation unit from the cache, so requests, which
+  // wait for the same translation unit, don't hold slots
+  bool background; // background slot is used
+
+  // tokenization stops with error, if time budget (in ms, time in queue for
+  // parse slot is not counted) is exceeded or translation unit uses more
+  // memory (in bytes) then the budget. 0 means no limit. Translation unit,
+  // which exceeds the memory budget, is not cached
+  unsigned int time_budget;
+  size_t       memory_budget;
+
+  // deadline of the time budget, set by tokenization after taking of slot
+  std::chrono::steady_clock::time_point deadline;
+
+  // if not nullptr, then set to true if tokenization was stopped by a budget
+  bool *exceeded;
+};
+
+
 hl::token_list clang_tokenize(const char * filename,
                               int          argc,
                               const char * argv[],
                               std::string &err) noexcept;
-}
+
+/**\brief same as previous, but file is not read from file system: buf_body
+ * is used as its content
+ */
+hl::token_list clang_tokenize(const char *       buf_name,
+                              const std::string &buf_body,
+                              int                argc,
+                              const char *       argv[],
+                              std::string &      err) noexcept;
+
+/**\brief uses translation unit from the cache (if it exists) and reparses it
+ * with buf_body as content of the buffer. Translation unit for the buffer will
+ * be created and put to the cache otherwise
+ *
+ * \param buf_name used (with compilation flags) as key for the cache
+ */
+hl::token_list clang_tokenize(hl::tu_cache &          cache,
+                              const char *            buf_name,
+                              const std::string &     buf_body,
+                              int                     argc,
+                              const char *            argv[],
+                              std::string &           err,
+                              const tokenize_options &options =
+                                  tokenize_options{}) noexcept;
+
+/**\brief fast tokenization of the buffer without its included files, so
+ * groups of tokens depend only on declarations from the buffer itself, and
+ * errors in the code don't stop tokenization. Translation unit is not
+ * cached, only index of the cache is used. Incremental annotation and
+ * includes of the options are not used
+ */
+hl::token_list clang_tokenize_lexical(const hl::tu_cache &     cache,
+                                      const char *            buf_name,
+                                      const std::string &     buf_body,
+                                      int                     argc,
+                                      const char *            argv[],
+                                      std::string &           err,
+                                      const tokenize_options &options =
+                                          tokenize_options{}) noexcept;
+
+/**\brief reparse translation unit from the cache without tokenization, so
+ * next request for the buffer is handled by fast reparse. New translation
+ * unit is not created
+ *
+ * \param includes files included by translation unit after reparsing
+ *
+ * \return false if there is no translation unit for the buffer in the cache,
+ * or it can not be reparsed
+ */
+bool clang_reparse(hl::tu_cache &            cache,
+                   const char *              buf_name,
+                   const std::string &       buf_body,
+                   int                       argc,
+                   const char *              argv[],
+                   std::vector<std::string> &includes) noexcept;
+} // namespace hl
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <clang-c/CXCompilationDatabase.h>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace hl {
+/**\brief compilation flags of one file. Flags are not copied, so argv stays
+ * valid while the object exists
+ */
+struct compile_flags {
+  compile_flags() noexcept            = default;
+  compile_flags(const compile_flags &) = delete;
+  compile_flags &operator=(const compile_flags &) = delete;
+
+  std::vector<std::string>  args;
+  std::vector<const char *> argv;
+};
+
+using compile_flags_ptr = std::shared_ptr<const compile_flags>;
+
+/**\brief compilation flags from compile_commands.json. Flags are parsed once
+ * for every file, and all of them are dropped after changing of the database
+ * file. Can be used from several threads
+ */
+class compile_db {
+public:
+  /**\param directory contains compile_commands.json
+   */
+  explicit compile_db(const std::string &directory) noexcept;
+  ~compile_db() noexcept;
+
+  compile_db(const compile_db &) = delete;
+  compile_db &operator=(const compile_db &) = delete;
+
+  /**\return flags for the file, or nullptr if the database doesn't contain
+   * the file
+   */
+  compile_flags_ptr get(const std::string &filename) noexcept;
+
+private:
+  /**\brief reload the database if its file was changed. Modification time is
+   * checked not more often than once per second
+   */
+  void update() noexcept;
+
+  std::string           directory_;
+  std::string           db_file_;
+  CXCompilationDatabase db_;
+  time_t                modify_time_;
+
+  std::chrono::steady_clock::time_point check_time_;
+
+  std::mutex                               mutex_;
+  std::map<std::string, compile_flags_ptr> flags_; // by filenames
+};
+} // namespace hl
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "token.hpp"
+#include <string>
+
+
+namespace hl {
+/**\brief persistent storage of latest tokens for every buffer (with
+ * compilation flags), so results survive restarts of the server. Every result
+ * is stored in separate file with hash of buffer content, file is
+ * memory-mapped on loading. Can be used from several threads and processes
+ *
+ * \note group names are stored with results, because ids of groups can differ
+ * between processes
+ */
+class disk_cache {
+public:
+  /**\param directory must exist
+   */
+  explicit disk_cache(const std::string &directory) noexcept;
+
+  /**\param key same as for translation unit cache
+   *
+   * \return false if there is no result for the key, or the result was
+   * stored for other content of the buffer
+   */
+  bool load(const std::string &key,
+            const std::string &buf_body,
+            token_list &       tokens) const noexcept;
+
+  /**\brief replace previous result for the key
+   */
+  void store(const std::string &key,
+             const std::string &buf_body,
+             const token_list & tokens) const noexcept;
+
+private:
+  std::string filename(const std::string &key) const;
+
+  std::string directory_;
+};
+} // namespace hl
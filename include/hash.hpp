@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace hl {
+const uint64_t hash_seed = 14695981039346656037ull;
+
+/**\brief FNV-1a hash, unlike std::hash it is same for all builds of the
+ * server, so it can be stored on disk
+ *
+ * \param seed result of previous call for hashing of several strings
+ */
+uint64_t hash_string(const std::string &str,
+                     uint64_t           seed = hash_seed) noexcept;
+
+/**\return hashes of every line of the string, lines are delimited by '\n'
+ */
+std::vector<uint64_t> hash_lines(const std::string &str) noexcept;
+
+/**\param time modification time of the file in seconds
+ */
+uint64_t hash_file_time(const std::string &file,
+                        long long          time,
+                        uint64_t           seed = hash_seed) noexcept;
+
+/**\brief files, used for some result, with hash of their names and
+ * modification times (see hash_file_time), so changes of the files can be
+ * found later
+ */
+struct file_stamp {
+  std::vector<std::string> files; // sorted
+  uint64_t                 stamp;
+};
+} // namespace hl
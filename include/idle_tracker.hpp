@@ -0,0 +1,106 @@
+#pragma once
+
+#include "tu_cache.hpp"
+#include <chrono>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace hl {
+/**\brief tracks buffers with cached translation units and files included by
+ * them. If some included file was changed (detected by inotify), then buffer
+ * is reparsed in background after the buffer is not used for the interval, so
+ * next request for the buffer is handled by fast reparse of fresh translation
+ * unit. Tracker is not thread safe, it must be used only from main thread of
+ * worker
+ */
+class idle_tracker {
+public:
+  // data for reparsing of translation unit
+  struct job {
+    std::string              key; // of translation unit cache
+    std::string              buf_name;
+    std::string              buf_body;
+    std::vector<std::string> args;
+  };
+
+  explicit idle_tracker(std::chrono::milliseconds interval) noexcept;
+  ~idle_tracker() noexcept;
+
+  idle_tracker(const idle_tracker &) = delete;
+  idle_tracker &operator=(const idle_tracker &) = delete;
+
+  /**\return false if inotify or timer can not be created
+   */
+  bool valid() const noexcept;
+
+  /**\brief descriptors for polling, readable on changes of watched files and
+   * on every tick of timer
+   */
+  int inotify_fd() const noexcept;
+  int timer_fd() const noexcept;
+
+  /**\brief buffer was handled by request, so its translation unit is fresh
+   *
+   * \param includes files included by translation unit, if empty, then
+   * previous ones are used
+   */
+  void touch(const std::string &             key,
+             const std::string &             buf_name,
+             std::string &&                  buf_body,
+             std::vector<std::string> &&     args,
+             const std::vector<std::string> &includes);
+
+  /**\brief read events from inotify and mark buffers, which includes changed
+   * files
+   *
+   * \return keys of marked buffers
+   */
+  std::set<std::string> handle_file_changes();
+
+  /**\brief read timer and collect jobs for idle buffers with changed
+   * included files. Buffers without translation units in the cache are
+   * forgotten
+   */
+  std::list<job> idle_jobs(const tu_cache &cache);
+
+  /**\brief background reparse of the buffer is finished
+   */
+  void finish(const std::string &             key,
+              const std::vector<std::string> &includes);
+
+private:
+  // file in watched directory
+  using watched_file = std::pair<int, std::string>;
+
+  struct buffer {
+    std::string               buf_name;
+    std::string               buf_body;
+    std::vector<std::string>  args;
+    std::vector<watched_file> files;
+
+    std::chrono::steady_clock::time_point last_use;
+
+    bool changed; // some included file was changed after latest parsing
+    bool running; // reparsed in background
+  };
+
+  void watch_includes(const std::string &             key,
+                      buffer &                        buf,
+                      const std::vector<std::string> &includes);
+
+  void unwatch(const std::string &key, buffer &buf);
+
+  std::chrono::milliseconds interval_;
+  int                       inotify_fd_;
+  int                       timer_fd_;
+
+  std::map<std::string, buffer>                 buffers_; // by keys
+  std::map<std::string, int>                    directories_; // watches
+  std::map<watched_file, std::set<std::string>> watched_;     // keys
+};
+} // namespace hl
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+
+namespace hl {
+namespace metrics {
+enum class stage {
+  request_parse, // json or msgpack
+  validation,    // by json schema
+  parse,         // clang_parseTranslationUnit2
+  reparse,       // clang_reparseTranslationUnit
+  annotate,      // clang_annotateTokens
+  classify,      // groups and locations of tokens
+  serialize,     // response
+  write,         // of responses to socket
+  request,       // from start of handling to serialization of response
+  count
+};
+
+enum class counter {
+  requests,
+  cancelled,
+  cache_hits,
+  cache_misses,
+  cache_evictions,
+  disk_cache_hits,
+  response_cache_hits,
+  over_budget,
+  count
+};
+
+using duration = std::chrono::steady_clock::duration;
+
+/**\brief allocate storage of metrics, shared between processes. Must be
+ * called before forking of workers, without it metrics are not collected
+ *
+ * \return false if storage can not be allocated
+ */
+bool init() noexcept;
+
+/**\brief add duration of the stage to its histogram
+ * \note all functions for metrics are thread and process safe
+ */
+void record(stage which, duration time) noexcept;
+
+void increment(counter which) noexcept;
+
+/**\return text report with count, mean, p50, p99 and max duration of every
+ * stage, values of counters and hit rate of translation unit caches
+ */
+std::string report();
+
+/**\brief records time from creating to destroying, or to stop
+ */
+class scoped_timer {
+public:
+  explicit scoped_timer(stage which) noexcept;
+  ~scoped_timer() noexcept;
+
+  scoped_timer(const scoped_timer &) = delete;
+  scoped_timer &operator=(const scoped_timer &) = delete;
+
+  void stop() noexcept;
+
+private:
+  stage                                 stage_;
+  std::chrono::steady_clock::time_point start_;
+  bool                                  stopped_;
+};
+} // namespace metrics
+} // namespace hl
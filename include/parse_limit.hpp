@@ -0,0 +1,45 @@
+#pragma once
+
+
+namespace hl {
+namespace parse_limit {
+/**\brief create semaphores, shared between processes. Must be called before
+ * forking of workers, without it count of parses is not limited. Slots of
+ * worker are returned by kernel if the worker crashes. Semaphores are removed
+ * only by finish, so if the master is killed by SIGKILL, then the set stays in
+ * the system until it is removed by `ipcrm -s <id>` (see id)
+ *
+ * \param count max count of concurrent parses in all workers. Background
+ * parses can take only half of them, so other requests are not blocked by
+ * background ones
+ *
+ * \return false if semaphores can not be created
+ */
+bool init(unsigned int count) noexcept;
+
+/**\brief remove semaphores from the system. Must be called only by process,
+ * which called init, after finishing of all workers
+ */
+void finish() noexcept;
+
+/**\return id of semaphore set or -1, if init was not called
+ */
+int id() noexcept;
+
+/**\brief holds slot for parsing from creating to destroying, waits until some
+ * slot is free
+ */
+class scoped_slot {
+public:
+  explicit scoped_slot(bool background) noexcept;
+  ~scoped_slot() noexcept;
+
+  scoped_slot(const scoped_slot &) = delete;
+  scoped_slot &operator=(const scoped_slot &) = delete;
+
+private:
+  bool background_;
+  bool acquired_;
+};
+} // namespace parse_limit
+} // namespace hl
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "text_edit.hpp"
+#include "token.hpp"
+#include <string>
+
+
+namespace hl {
+/**\brief requests with higher priority are handled first, from highest to
+ * lowest
+ */
+enum class priority {
+  focused,
+  visible,
+  background,
+  count
+};
+
+struct request {
+  int         message_number;
+  std::string version;
+  std::string id;
+  std::string buf_type;
+  std::string buf_name;
+  std::string buf_body;
+  std::string additional_info;
+
+  // range of lines for tokenization, 0 means begin (or end) of buffer.
+  // Supported since v1.2
+  unsigned int begin_line;
+  unsigned int end_line;
+
+  // response must contain only changes since previous response for the
+  // buffer. Supported since v1.3
+  bool diff_mode;
+
+  // server must keep body of the buffer, so next requests can contain only
+  // edits. If incremental is true, then buf_body is empty and edits must be
+  // applied to previous body of the buffer. Supported since v1.4
+  bool               edits_mode;
+  bool               incremental;
+  hl::text_edit_list edits;
+
+  // visible if not set. Supported since v1.2
+  hl::priority priority;
+
+  // fast tokenization without included files is requested, lexical_mode is
+  // true if the protocol supports it. Supported since v1.2
+  bool lexical_mode;
+  bool lexical;
+};
+
+struct response {
+  int            message_number;
+  std::string    version;
+  std::string    id;
+  std::string    buf_type;
+  std::string    buf_name;
+  int            return_code;
+  std::string    error_message;
+  hl::token_list tokens;
+
+  // used only if request was in diff mode, in this case if is_diff is true,
+  // then tokens contains only added tokens, and rows of previous tokens
+  // starting from shift_line are shifted by shift_rows
+  bool           diff_mode;
+  bool           is_diff;
+  hl::token_list removed_tokens;
+  unsigned int   shift_line;
+  int            shift_rows;
+
+  // tokens are result of lexical tokenization, sent to client only if the
+  // protocol supports it
+  bool lexical_mode;
+  bool lexical;
+};
+
+/**\brief format of messages on wire. Json messages are delimited by new
+ * line, msgpack messages are length prefixed
+ */
+enum class wire_format {
+  json,
+  msgpack,
+};
+
+/**\brief parse and validate request
+ *
+ * \param validate if false, then request will not be validated by json
+ * schema, so it can be used only for trusted clients
+ *
+ * \return false if data is not valid request
+ */
+bool parse_request(const char * data,
+                   hl::request &req,
+                   bool         validate = true) noexcept;
+
+/**\brief same as parse_request, but for request in msgpack format. Request
+ * is validated by same json schema
+ */
+bool parse_msgpack_request(const char * data,
+                           size_t       size,
+                           hl::request &req,
+                           bool         validate = true) noexcept;
+
+/**\brief append serialized response to out. Tokens are written directly
+ * from token list, without building of intermediate json document
+ */
+void serialize_response(const hl::response &resp, std::string &out) noexcept;
+
+/**\brief same as serialize_response, but in msgpack format. Structure of
+ * response is same as for json
+ */
+void serialize_msgpack_response(const hl::response &resp,
+                                std::string &       out) noexcept;
+} // namespace hl
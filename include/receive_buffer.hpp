@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+namespace hl {
+/**\brief growable buffer for delimited messages. Every byte is checked for
+ * delimiter only once, so handling of large messages, readen by chunks, takes
+ * linear time. Also can be switched to length prefixed messages
+ */
+class receive_buffer {
+public:
+  /**\param max_message_size messages (without delimiter) greater then the
+   * value will be dropped, 0 means no limit
+   */
+  receive_buffer(char delimiter, size_t max_message_size) noexcept;
+
+  /**\brief switch to length prefixed messages. Every message starts by tag
+   * byte and 4 bytes of message size in big-endian order, delimiter is not
+   * used. Must be called before first pop
+   */
+  void use_length_prefix(char tag) noexcept;
+
+  /**\return true if some length prefixed message has invalid tag, in this
+   * case all next data is ignored
+   */
+  bool broken() const noexcept;
+
+  /**\return pointer to at least size bytes of free space for reading data
+   * \warning invalidates all messages returned by pop
+   */
+  char *prepare(size_t size);
+
+  /**\brief add count bytes, readen to memory returned by prepare
+   */
+  void commit(size_t count) noexcept;
+
+  /**\brief get next complete message. Delimiter of the message replaced by
+   * '\0', so message can be used as c-string.
+   *
+   * \return false if there is no complete message
+   * \note message is valid until next call of prepare
+   * \note length prefixed messages are not null-terminated
+   */
+  bool pop(const char *&message, size_t &size) noexcept;
+
+  /**\return size of not complete message
+   */
+  size_t pending() const noexcept;
+
+  /**\return true if not handled data exceeds max message size, in this case
+   * messages must be popped before reading of next data, so size of buffer
+   * is limited
+   */
+  bool full() const noexcept;
+
+  /**\return count of bytes dropped because of message size limit since
+   * previous call
+   */
+  size_t dropped() noexcept;
+
+private:
+  char              delimiter_;
+  size_t            max_message_size_;
+  std::vector<char> buf_;
+  size_t            begin_;   // begin of not handled data
+  size_t            end_;     // end of data
+  size_t            scanned_; // data before the position has no delimiter
+  size_t            dropped_;
+  bool              skip_; // drop data until next delimiter
+
+  // for length prefixed messages
+  bool   length_prefix_;
+  char   tag_;
+  size_t skip_size_; // count of bytes of too large message, not dropped yet
+  bool   broken_;
+
+  bool pop_length_prefixed(const char *&message, size_t &size) noexcept;
+};
+} // namespace hl
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "hash.hpp"
+#include "token.hpp"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+namespace hl {
+using token_list_ptr = std::shared_ptr<const token_list>;
+using file_stamp_ptr = std::shared_ptr<const file_stamp>;
+
+/**\brief keeps tokens of latest responses for whole buffers with hash of
+ * their content, so unchanged buffer can be handled without libclang. Count of
+ * entries is limited, least recently used ones are removed. Can be used from
+ * several threads
+ */
+class response_cache {
+public:
+  /**\param capacity max count of entries, 0 disables the cache
+   */
+  explicit response_cache(size_t capacity) noexcept;
+
+  /**\param key buffer name with compilation flags and type of buffer
+   *
+   * \return nullptr if there is no tokens for the key, they were got for
+   * other content of buffer, or some of their dependencies were changed on
+   * disk since tokenization (the entry is removed in this case)
+   */
+  token_list_ptr get(const std::string &key, uint64_t content_hash) noexcept;
+
+  /**\brief replace previous tokens for the key
+   *
+   * \param dependencies included files, which were used for the tokens
+   */
+  void put(const std::string &key,
+           uint64_t           content_hash,
+           token_list_ptr     tokens,
+           file_stamp_ptr     dependencies) noexcept;
+
+  /**\brief remove entries for all keys, which start with the prefix
+   */
+  void erase_prefix(const std::string &prefix) noexcept;
+
+private:
+  struct slot {
+    uint64_t                         content_hash;
+    token_list_ptr                   tokens;
+    file_stamp_ptr                   dependencies;
+    std::list<std::string>::iterator lru_position;
+  };
+
+  size_t capacity_;
+
+  std::mutex                  mutex_;
+  std::map<std::string, slot> slots_;
+  std::list<std::string>      lru_; // keys, most recently used first
+};
+} // namespace hl
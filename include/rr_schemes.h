@@ -133,3 +133,604 @@ const char *response_schema_v11 = R"(
     }
 }
 )";
+
+const char *request_schema_v12 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "request schema v1.2",
+    "description": "schema for validate requests for hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/request_body" }
+    ],
+    "minItems": 2,
+    "maxItems": 2,
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "request_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "buf_body", "additional_info"
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.2"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "buf_body": {
+                    "comment": "complete buffer entity",
+                    "type": "string"
+                },
+                "additional_info": {
+                    "comment": "some handler specific information",
+                    "type": "string"
+                },
+                "range": {
+                    "comment": "optional, if set, then only the lines will be tokenized",
+                    "$ref": "#/definitions/range"
+                },
+                "priority": {
+                    "comment": "optional, requests for focused buffers are handled first, visible by default",
+                    "enum": ["focused", "visible", "background"]
+                },
+                "lexical": {
+                    "comment": "optional, if true, then buffer is tokenized fast without included files",
+                    "type": "boolean"
+                }
+            },
+            "additionalProperties": false
+        },
+        "range": {
+            "type": "object",
+            "required": [
+                "begin_line", "end_line"
+            ],
+            "properties": {
+                "begin_line": {
+                    "comment": "first line of range, starting from 1",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "end_line": {
+                    "comment": "last line of range, included",
+                    "type": "integer",
+                    "minimum": 1
+                }
+            },
+            "additionalProperties": false
+        }
+    }
+}
+)";
+
+const char *response_schema_v12 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "response schema v1.2",
+    "description": "schema for validate response of hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/response_body" }
+    ],
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "response_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "return_code", "error_message", "tokens"
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.2"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "return_code": {
+                    "comment": "0 in case of success, otherwise some not null integer value",
+                    "type": "integer"
+                },
+                "error_message": {
+                    "comment": "contains inforamtion about error (if some error caused) ",
+                    "type": "string"
+                },
+                "lexical": {
+                    "comment": "true if tokens are result of lexical tokenization, groups of some tokens can be imprecise",
+                    "type": "boolean"
+                },
+                "tokens": {
+                    "comment": "contains dictionary of tokens by token groups",
+                    "$ref": "#/definitions/tokens"
+                }
+            },
+            "additionalProperties": false
+        },
+        "tokens": {
+            "type": "object",
+            "patternProperties": {
+                "^.+$": {
+                    "$ref": "#/definitions/array_of_token_koordinates"
+                }
+            },
+            "additionalProperties": false
+        },
+        "array_of_token_koordinates": {
+            "type": "array",
+            "items": {
+                "$ref": "#/definitions/token_koordinate"
+            }
+        },
+        "token_koordinate": {
+            "comment": "contains array of integers with: row, column, token_size",
+            "type": "array",
+            "items": {
+                "type": "integer"
+            },
+            "minItems": 3,
+            "maxItems": 3
+        }
+    }
+}
+)";
+
+const char *request_schema_v13 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "request schema v1.3",
+    "description": "schema for validate requests for hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/request_body" }
+    ],
+    "minItems": 2,
+    "maxItems": 2,
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "request_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "buf_body", "additional_info"
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.3"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "buf_body": {
+                    "comment": "complete buffer entity",
+                    "type": "string"
+                },
+                "additional_info": {
+                    "comment": "some handler specific information",
+                    "type": "string"
+                },
+                "range": {
+                    "comment": "optional, if set, then only the lines will be tokenized",
+                    "$ref": "#/definitions/range"
+                },
+                "priority": {
+                    "comment": "optional, requests for focused buffers are handled first, visible by default",
+                    "enum": ["focused", "visible", "background"]
+                },
+                "lexical": {
+                    "comment": "optional, if true, then buffer is tokenized fast without included files",
+                    "type": "boolean"
+                }
+            },
+            "additionalProperties": false
+        },
+        "range": {
+            "type": "object",
+            "required": [
+                "begin_line", "end_line"
+            ],
+            "properties": {
+                "begin_line": {
+                    "comment": "first line of range, starting from 1",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "end_line": {
+                    "comment": "last line of range, included",
+                    "type": "integer",
+                    "minimum": 1
+                }
+            },
+            "additionalProperties": false
+        }
+    }
+}
+)";
+
+const char *response_schema_v13 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "response schema v1.3",
+    "description": "schema for validate response of hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/response_body" }
+    ],
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "response_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "return_code", "error_message", "diff", "tokens", "removed_tokens"
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.3"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "return_code": {
+                    "comment": "0 in case of success, otherwise some not null integer value",
+                    "type": "integer"
+                },
+                "error_message": {
+                    "comment": "contains inforamtion about error (if some error caused) ",
+                    "type": "string"
+                },
+                "diff": {
+                    "comment": "if true, then tokens contains only added tokens, otherwise all tokens",
+                    "type": "boolean"
+                },
+                "lexical": {
+                    "comment": "true if tokens are result of lexical tokenization, groups of some tokens can be imprecise",
+                    "type": "boolean"
+                },
+                "tokens": {
+                    "comment": "contains dictionary of tokens by token groups",
+                    "$ref": "#/definitions/tokens"
+                },
+                "removed_tokens": {
+                    "comment": "tokens removed since previous response for the buffer, empty if diff is false",
+                    "$ref": "#/definitions/tokens"
+                },
+                "shift": {
+                    "comment": "only if diff is true, rows of previous tokens starting from line must be shifted by rows after removing of removed_tokens",
+                    "type": "object",
+                    "required": [
+                        "line", "rows"
+                    ],
+                    "properties": {
+                        "line": {
+                            "type": "integer",
+                            "minimum": 1
+                        },
+                        "rows": {
+                            "type": "integer"
+                        }
+                    },
+                    "additionalProperties": false
+                }
+            },
+            "additionalProperties": false
+        },
+        "tokens": {
+            "type": "object",
+            "patternProperties": {
+                "^.+$": {
+                    "$ref": "#/definitions/array_of_token_koordinates"
+                }
+            },
+            "additionalProperties": false
+        },
+        "array_of_token_koordinates": {
+            "type": "array",
+            "items": {
+                "$ref": "#/definitions/token_koordinate"
+            }
+        },
+        "token_koordinate": {
+            "comment": "contains array of integers with: row, column, token_size",
+            "type": "array",
+            "items": {
+                "type": "integer"
+            },
+            "minItems": 3,
+            "maxItems": 3
+        }
+    }
+}
+)";
+
+const char *request_schema_v14 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "request schema v1.4",
+    "description": "schema for validate requests for hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/request_body" }
+    ],
+    "minItems": 2,
+    "maxItems": 2,
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "request_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "additional_info"
+            ],
+            "oneOf": [
+                { "required": [ "buf_body" ] },
+                { "required": [ "edits" ] }
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.4"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "buf_body": {
+                    "comment": "complete buffer entity",
+                    "type": "string"
+                },
+                "additional_info": {
+                    "comment": "some handler specific information",
+                    "type": "string"
+                },
+                "edits": {
+                    "comment": "changes since previous request for the buffer, can be used instead of buf_body",
+                    "type": "array",
+                    "items": {
+                        "$ref": "#/definitions/edit"
+                    }
+                },
+                "range": {
+                    "comment": "optional, if set, then only the lines will be tokenized",
+                    "$ref": "#/definitions/range"
+                },
+                "priority": {
+                    "comment": "optional, requests for focused buffers are handled first, visible by default",
+                    "enum": ["focused", "visible", "background"]
+                },
+                "lexical": {
+                    "comment": "optional, if true, then buffer is tokenized fast without included files",
+                    "type": "boolean"
+                }
+            },
+            "additionalProperties": false
+        },
+        "range": {
+            "type": "object",
+            "required": [
+                "begin_line", "end_line"
+            ],
+            "properties": {
+                "begin_line": {
+                    "comment": "first line of range, starting from 1",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "end_line": {
+                    "comment": "last line of range, included",
+                    "type": "integer",
+                    "minimum": 1
+                }
+            },
+            "additionalProperties": false
+        },
+        "edit": {
+            "comment": "replace text between begin and end by new text, edits are applied in order",
+            "type": "object",
+            "required": [
+                "begin_line", "begin_column", "end_line", "end_column", "text"
+            ],
+            "properties": {
+                "begin_line": {
+                    "comment": "starting from 1",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "begin_column": {
+                    "comment": "starting from 1, in bytes",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "end_line": {
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "end_column": {
+                    "comment": "not included",
+                    "type": "integer",
+                    "minimum": 1
+                },
+                "text": {
+                    "comment": "new text for the range",
+                    "type": "string"
+                }
+            },
+            "additionalProperties": false
+        }
+    }
+}
+)";
+
+const char *response_schema_v14 = R"(
+{
+    "$schema": "http://json-schema/schema#",
+    "title": "response schema v1.4",
+    "description": "schema for validate response of hl-server",
+    "type": "array",
+    "items": [
+      { "$ref": "#/definitions/message_number" },
+      { "$ref": "#/definitions/response_body" }
+    ],
+    "definitions": {
+        "message_number": {
+            "type": "integer"
+        },
+        "response_body": {
+            "type": "object",
+            "required": [
+                "version", "id", "buf_type", "buf_name", "return_code", "error_message", "diff", "tokens", "removed_tokens"
+            ],
+            "properties": {
+                "version": {
+                    "comment": "version of protocol",
+                    "type": "string",
+                    "const": "v1.4"
+                },
+                "id": {
+                    "comment": "client id",
+                    "type": "string"
+                },
+                "buf_type": {
+                    "comment": "type of buffer entity",
+                    "type": "string"
+                },
+                "buf_name": {
+                    "comment": "name of buffer",
+                    "type": "string"
+                },
+                "return_code": {
+                    "comment": "0 in case of success, otherwise some not null integer value",
+                    "type": "integer"
+                },
+                "error_message": {
+                    "comment": "contains inforamtion about error (if some error caused) ",
+                    "type": "string"
+                },
+                "diff": {
+                    "comment": "if true, then tokens contains only added tokens, otherwise all tokens",
+                    "type": "boolean"
+                },
+                "lexical": {
+                    "comment": "true if tokens are result of lexical tokenization, groups of some tokens can be imprecise",
+                    "type": "boolean"
+                },
+                "tokens": {
+                    "comment": "contains dictionary of tokens by token groups",
+                    "$ref": "#/definitions/tokens"
+                },
+                "removed_tokens": {
+                    "comment": "tokens removed since previous response for the buffer, empty if diff is false",
+                    "$ref": "#/definitions/tokens"
+                },
+                "shift": {
+                    "comment": "only if diff is true, rows of previous tokens starting from line must be shifted by rows after removing of removed_tokens",
+                    "type": "object",
+                    "required": [
+                        "line", "rows"
+                    ],
+                    "properties": {
+                        "line": {
+                            "type": "integer",
+                            "minimum": 1
+                        },
+                        "rows": {
+                            "type": "integer"
+                        }
+                    },
+                    "additionalProperties": false
+                }
+            },
+            "additionalProperties": false
+        },
+        "tokens": {
+            "type": "object",
+            "patternProperties": {
+                "^.+$": {
+                    "$ref": "#/definitions/array_of_token_koordinates"
+                }
+            },
+            "additionalProperties": false
+        },
+        "array_of_token_koordinates": {
+            "type": "array",
+            "items": {
+                "$ref": "#/definitions/token_koordinate"
+            }
+        },
+        "token_koordinate": {
+            "comment": "contains array of integers with: row, column, token_size",
+            "type": "array",
+            "items": {
+                "type": "integer"
+            },
+            "minItems": 3,
+            "maxItems": 3
+        }
+    }
+}
+)";
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace hl {
+/**\brief replacement of range of text. Lines and columns start from 1,
+ * columns are counted in bytes, end of range is not included
+ */
+struct text_edit {
+  unsigned int begin_line;
+  unsigned int begin_column;
+  unsigned int end_line;
+  unsigned int end_column;
+  std::string  text;
+};
+
+using text_edit_list = std::vector<text_edit>;
+
+/**\brief apply edits one by one, so every edit uses positions in text after
+ * previous edits
+ *
+ * \return false if some edit has range out of text, in this case text stays
+ * partially changed
+ */
+bool apply_edits(std::string &text, const text_edit_list &edits) noexcept;
+} // namespace hl
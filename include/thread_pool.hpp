@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace hl {
+/**\brief fixed count of threads, which handle tasks in order of priorities,
+ * tasks with same priority are handled in order of pushing
+ */
+class thread_pool {
+public:
+  using task = std::function<void()>;
+
+  /**\param priority_count count of priorities, 0 is the highest one
+   */
+  explicit thread_pool(size_t thread_count, size_t priority_count = 1);
+
+  /**\brief waits for finishing of running tasks, not started tasks are
+   * dropped
+   */
+  ~thread_pool() noexcept;
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  /**\param priority values greater then count of priorities are handled as
+   * the lowest priority
+   */
+  void push(task new_task, size_t priority = 0);
+
+private:
+  void run() noexcept;
+
+  std::mutex                    mutex_;
+  std::condition_variable       condition_;
+  std::vector<std::deque<task>> tasks_; // by priorities
+  size_t                        task_count_;
+  std::vector<std::thread>      threads_;
+  bool                          stop_;
+};
+} // namespace hl
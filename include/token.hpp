@@ -1,16 +1,60 @@
 #pragma once
 
 #include <array>
-#include <list>
 #include <string>
+#include <vector>
 
 namespace hl {
 using token_location = std::array<unsigned int, 3>; // row, column, lenght
 
+/**\brief index of interned group name
+ */
+using group_id = unsigned int;
+
 struct token {
-  std::string    group;
+  group_id       group;
   token_location pos;
 };
 
-using token_list = std::list<token>;
+using token_list = std::vector<token>;
+
+/**\brief range of rows (starting from 1), changed between previous and
+ * current tokens. Rows after the range are shifted by
+ * current_end - previous_end
+ */
+struct line_change {
+  unsigned int begin;        // first changed row
+  unsigned int previous_end; // first row after the range in previous
+  unsigned int current_end;  // first row after the range in current
+};
+
+/**\brief compare two lists of tokens, sorted by position (as returned by
+ * tokenizer). Tokens after the change are compared with shifted rows, so
+ * inserting of lines doesn't change tokens after them, tokens of changed rows
+ * are always removed and added
+ *
+ * \param added tokens from current, which are absent in previous
+ * \param removed tokens from previous (with previous positions), which are
+ * absent in current
+ */
+void diff_tokens(const token_list & previous,
+                 const token_list & current,
+                 const line_change &change,
+                 token_list &       added,
+                 token_list &       removed) noexcept;
+
+
+/**\return id of the group, if group with the name was not registered
+ * before, then registers it
+ * \note all functions for groups are thread safe
+ */
+group_id intern_group(const char *name) noexcept;
+
+/**\return name of registered group
+ */
+const std::string &group_name(group_id id) noexcept;
+
+/**\return count of registered groups, all ids are less then the value
+ */
+size_t group_count() noexcept;
 } // namespace hl
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "token.hpp"
+#include <clang-c/Index.h>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+
+namespace hl {
+enum class parse_mode {
+  full,    // every reparse handles all included headers
+  preamble // uses precompiled preamble, so only code after includes reparsed
+};
+
+/**\return parse_mode::full if the string is not valid name of mode
+ */
+parse_mode parse_mode_from_string(const char *str, bool &ok) noexcept;
+
+/**\brief keeps translation units alive between requests, so next request for
+ * same buffer (with same compilation flags) can be handled by reparsing.
+ * Cache can be used from several threads, translation unit is owned by one
+ * thread from taking until putting back. If memory used by translation units
+ * exceeds the budget, then least recently used ones are disposed
+ */
+class tu_cache {
+public:
+  struct entry {
+    CXTranslationUnit translation_unit = nullptr;
+    std::string       filename; // name of main file of translation unit
+
+    // latest tokenization of whole buffer, used for incremental annotation.
+    // Empty if incremental annotation is not used. Stamp identifies included
+    // files (with times of modification) of the tokenization
+    std::string    body;
+    hl::token_list tokens;
+    uint64_t       includes_stamp = 0;
+  };
+
+  struct statistics {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t memory; // in bytes, used by all cached translation units
+  };
+
+  /**\param memory_budget in bytes, 0 means no limit. Latest put translation
+   * unit is never evicted, even if it exceeds the budget
+   */
+  explicit tu_cache(parse_mode mode          = parse_mode::full,
+                    size_t     memory_budget = 0) noexcept;
+  ~tu_cache() noexcept;
+
+  tu_cache(const tu_cache &) = delete;
+  tu_cache &operator=(const tu_cache &) = delete;
+
+  CXIndex index() const noexcept;
+
+  /**\return options for clang_parseTranslationUnit2 depending on parse mode
+   */
+  unsigned parse_options() const noexcept;
+
+  /**\brief remove entry from cache and return it to caller. Taken entry can
+   * be used only by one thread, so if the entry is taken by other thread, then
+   * waits until it is put back (or released)
+   *
+   * \return false if no entry for the key
+   */
+  bool take(const std::string &key, entry &taken) noexcept;
+
+  /**\brief add entry to cache, previous entry for same key (if some thread
+   * put it before) is disposed
+   */
+  void put(const std::string &key, entry &&new_entry) noexcept;
+
+  /**\brief taken entry was disposed by caller instead of putting back
+   */
+  void release(const std::string &key) noexcept;
+
+  /**\return true if there is entry for the key, doesn't change statistics
+   */
+  bool contains(const std::string &key) const noexcept;
+
+  /**\brief drop result of latest tokenization of the entry, so next
+   * tokenization of the entry is not incremental. If the entry is taken now,
+   * then the result is dropped when the entry is put back
+   */
+  void drop_tokens(const std::string &key) noexcept;
+
+  statistics stats() const noexcept;
+
+  static std::string
+  make_key(const char *buf_name, int argc, const char *argv[]) noexcept;
+
+  /**\return memory (in bytes) used by translation unit
+   */
+  static size_t memory_usage(CXTranslationUnit translation_unit) noexcept;
+
+private:
+  struct slot {
+    entry                            value;
+    size_t                           memory;
+    std::list<std::string>::iterator lru_position;
+  };
+
+  CXIndex    index_;
+  parse_mode mode_;
+  size_t     memory_budget_;
+
+  mutable std::mutex          mutex_;
+  std::condition_variable     released_; // some taken entry is returned
+  std::map<std::string, slot> slots_;
+  std::list<std::string>      lru_;   // keys, most recently used first
+  std::set<std::string>       taken_; // keys of entries used by callers
+  std::set<std::string>       stale_; // taken entries with dropped tokens
+  statistics                  stats_;
+};
+} // namespace hl
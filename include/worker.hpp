@@ -0,0 +1,37 @@
+#pragma once
+
+#include "tu_cache.hpp"
+#include <cstddef>
+
+
+namespace hl {
+struct worker_options {
+  int          listener; // shared between all workers
+  size_t       max_message_size;
+  size_t       thread_count; // threads for tokenization, at least one
+  bool         validate_requests;
+  parse_mode   mode;
+  size_t       cache_memory; // budget of translation unit cache, 0 no limit
+  const char * compile_commands; // directory of database, can be nullptr
+  const char * cache_dir;        // directory of disk cache, can be nullptr
+  size_t       response_cache_size; // count of entries, 0 disables the cache
+  unsigned int idle_reparse;  // ms without requests for background reparse
+  bool         incremental;   // annotation of only changed lines
+  unsigned int time_budget;   // ms for tokenization of request, 0 no limit
+  size_t       memory_budget; // bytes for translation unit, 0 no limit
+  int          default_flags_count;
+  const char **default_flags;
+};
+
+/**\brief accepts connections from the listener and handles requests from
+ * them until SIGINT or SIGTERM is not received. Every worker owns long-lived
+ * translation unit cache, so it is shared between all connections handled by
+ * the worker. Requests for different buffers are tokenized concurrently by
+ * pool of threads, responses are sent in order of completion
+ *
+ * \warning SIGINT and SIGTERM must be blocked before calling the function
+ *
+ * \return exit code for worker process
+ */
+int run_worker(const worker_options &options) noexcept;
+} // namespace hl
@@ -1,33 +1,187 @@
 #include "clang_tokenize.hpp"
+#include "hash.hpp"
+#include "metrics.hpp"
+#include "parse_limit.hpp"
+#include <algorithm>
+#include <cctype>
 #include <clang-c/Index.h>
+#include <cstring>
+#include <map>
+#include <set>
 #include <vector>
 
+
+// count of tokens, annotated by one call, between checks for cancellation
+#define ANNOTATE_CHUNK_SIZE 4096u
+
+#define CANCELLED_ERROR "tokenization cancelled"
+#define BUDGET_ERROR    "tokenization exceeded budget of resources"
+
+// not interned group in cache of spelled groups
+#define NO_GROUP static_cast<hl::group_id>(-1)
+
+// incremental annotation is not used, if changed lines (with lines, which
+// contain same identifiers) are more then the part of buffer
+#define INCREMENTAL_MAX_PART 4
+// changed lines, which are closer then the gap, are annotated together
+#define INCREMENTAL_LINE_GAP 8u
+#define INCREMENTAL_MAX_RANGES 32
+
+// included files are skipped, and broken code doesn't stop parsing
+#define LEXICAL_PARSE_OPTIONS                                                  \
+  (CXTranslationUnit_DetailedPreprocessingRecord |                             \
+   CXTranslationUnit_SingleFileParse | CXTranslationUnit_KeepGoing)
+
+
 static const char *clang_errorToString(CXErrorCode code) noexcept;
 
-static std::string        get_token_group(const CXCursor &cursor) noexcept;
+static bool is_cancelled(const hl::cancel_callback &callback) noexcept;
+
+/**\brief checks deadline and (if translation unit is not nullptr) memory
+ * budget of the options, sets the exceeded flag of the options
+ *
+ * \return true if a budget is exceeded
+ */
+static bool
+is_over_budget(const hl::tokenize_options &options,
+               CXTranslationUnit           translation_unit) noexcept;
+
+/**\return options with deadline for time budget, started now
+ */
+static hl::tokenize_options
+start_budget(const hl::tokenize_options &options) noexcept;
+
+/**\brief reparse translation unit of the entry with new content of buffer
+ *
+ * \return false in case of error, in this case translation unit is disposed
+ */
+static bool reparse(hl::tu_cache::entry &entry,
+                    const std::string &  buf_body) noexcept;
+
+/**\brief collect unique names of all files included by translation unit
+ */
+static void get_includes(CXTranslationUnit         translation_unit,
+                         std::vector<std::string> &includes) noexcept;
+
+/**\return hash of names and times of modification of files included by
+ * translation unit, it is changed if some of included files were changed
+ */
+static uint64_t get_includes_stamp(CXTranslationUnit translation_unit) noexcept;
+
+/**\brief collect sorted names of files included by translation unit with
+ * stamp of times, when they were read
+ */
+static void get_dependencies(CXTranslationUnit translation_unit,
+                             hl::file_stamp &  dependencies) noexcept;
+
+/**\param ignore_fatal if true, then fatal diagnostics don't stop
+ * tokenization
+ */
+static hl::token_list
+tokenize_translation_unit(CXTranslationUnit           translation_unit,
+                          const char *                filename,
+                          const hl::tokenize_options &options,
+                          std::string &               err,
+                          bool                        ignore_fatal) noexcept;
+
+/**\brief tokenize translation unit using result of previous tokenization
+ * for unchanged lines. Changed lines are found by comparing of previous and
+ * current bodies. Annotation of token depends on declaration, so all lines
+ * with identifiers from changed lines are annotated too
+ *
+ * \return false if incremental tokenization is not possible (for example
+ * preprocessor directives were changed), in this case full tokenization is
+ * needed
+ */
+static bool tokenize_incremental(CXTranslationUnit           translation_unit,
+                                 const hl::tu_cache::entry & entry,
+                                 const std::string &         buf_body,
+                                 const hl::tokenize_options &options,
+                                 hl::token_list &            tokens,
+                                 std::string &               err) noexcept;
+
+/**\return offsets of begins of all lines, terminated by size of text
+ */
+static std::vector<size_t> line_starts(const std::string &text);
+
+/**\brief collect all identifier-like words from lines of the text
+ *
+ * \return false if lines can change lexing or classification of other lines:
+ * they contain preprocessor directive, delimiters of comments, strings or
+ * characters, line continuation, or brackets are not balanced
+ */
+static bool collect_words(const std::string &        text,
+                          const std::vector<size_t> &starts,
+                          unsigned int               begin_line,
+                          unsigned int               end_line,
+                          std::set<std::string> &    words);
+
+/**\return offset of begin of the line (starting from 1), or size of the data
+ * if the data has less lines
+ */
+static size_t
+line_offset(const char *data, size_t size, unsigned int line) noexcept;
+
+/**\brief converts offsets of tokens in file to lines and columns by its own
+ * scanning of the file contents. Offsets must not decrease, so every byte of
+ * file is scanned only once
+ */
+struct location_resolver {
+  const char * data;
+  size_t       size;
+  unsigned int line;
+  size_t       line_begin; // offset of current line
+};
+
+/**\brief get location of identifier token by only one file lookup in
+ * libclang
+ *
+ * \return false if location can not be resolved, in this case
+ * get_token_location must be used
+ */
+static bool resolve_location(location_resolver & resolver,
+                             CXTranslationUnit   translation_unit,
+                             CXToken             token,
+                             hl::token_location &location) noexcept;
+
+static hl::group_id       get_token_group(const CXCursor &cursor) noexcept;
 static hl::token_location get_token_location(CXTranslationUnit translation_unit,
                                              CXToken           token) noexcept;
-static std::string        map_token_kind(const CXCursorKind cursor_kind,
+static hl::group_id       map_token_kind(const CXCursorKind cursor_kind,
                                          const CXTypeKind   type_kind) noexcept;
-static std::string        map_type_kind(CXTypeKind const type_kind) noexcept;
+static hl::group_id       map_type_kind(CXTypeKind const type_kind) noexcept;
+
+/**\return group with name, spelled by libclang for the kind. Every kind is
+ * spelled and interned only once, next calls just get group from table.
+ * Tables are thread local, so no locking is needed
+ */
+template <typename Kind>
+static hl::group_id spelled_group(std::vector<hl::group_id> &table,
+                                  Kind                       kind,
+                                  CXString (*spelling)(Kind)) noexcept;
 
 namespace hl {
+tokenize_options::tokenize_options() noexcept
+    : begin_line{0}
+    , end_line{0}
+    , incremental{false}
+    , includes{nullptr}
+    , dependencies{nullptr}
+    , background{false}
+    , time_budget{0}
+    , memory_budget{0}
+    , deadline{std::chrono::steady_clock::time_point::max()}
+    , exceeded{nullptr} {
+}
+
 hl::token_list clang_tokenize(const char * filename,
                               int          argc,
                               const char * argv[],
                               std::string &err) noexcept {
-  hl::token_list        retval;
-  CXIndex               index;
-  CXTranslationUnit     translation_unit;
-  CXErrorCode           error_code;
-  CXFile                tru_file;
-  size_t                file_offset;
-  CXSourceLocation      begin_loc;
-  CXSourceLocation      end_loc;
-  CXSourceRange         range;
-  CXToken *             cx_tokens = nullptr;
-  unsigned int          num_tokens;
-  std::vector<CXCursor> cursors;
+  hl::token_list    retval;
+  CXIndex           index;
+  CXTranslationUnit translation_unit = nullptr;
+  CXErrorCode       error_code;
 
   index = clang_createIndex(0, 0);
   error_code =
@@ -42,10 +196,448 @@ hl::token_list clang_tokenize(const char * filename,
 
   if (error_code != CXError_Success) {
     err = clang_errorToString(error_code);
-    goto Finish;
+  } else {
+    retval = tokenize_translation_unit(translation_unit,
+                                       filename,
+                                       tokenize_options{},
+                                       err,
+                                       false);
+  }
+
+  clang_disposeTranslationUnit(translation_unit);
+  clang_disposeIndex(index);
+
+  return retval;
+}
+
+hl::token_list clang_tokenize(const char *       buf_name,
+                              const std::string &buf_body,
+                              int                argc,
+                              const char *       argv[],
+                              std::string &      err) noexcept {
+  hl::token_list    retval;
+  CXIndex           index;
+  CXTranslationUnit translation_unit = nullptr;
+  CXErrorCode       error_code;
+  CXUnsavedFile     unsaved_file;
+
+  unsaved_file.Filename = buf_name;
+  unsaved_file.Contents = buf_body.c_str();
+  unsaved_file.Length   = buf_body.size();
+
+  index = clang_createIndex(0, 0);
+  error_code =
+      clang_parseTranslationUnit2(index,
+                                  buf_name,
+                                  argv,
+                                  argc,
+                                  &unsaved_file,
+                                  1,
+                                  CXTranslationUnit_DetailedPreprocessingRecord,
+                                  &translation_unit);
+
+  if (error_code != CXError_Success) {
+    err = clang_errorToString(error_code);
+  } else {
+    retval = tokenize_translation_unit(translation_unit,
+                                       buf_name,
+                                       tokenize_options{},
+                                       err,
+                                       false);
+  }
+
+  clang_disposeTranslationUnit(translation_unit);
+  clang_disposeIndex(index);
+
+  return retval;
+}
+
+hl::token_list clang_tokenize(hl::tu_cache &          cache,
+                              const char *            buf_name,
+                              const std::string &     buf_body,
+                              int                     argc,
+                              const char *            argv[],
+                              std::string &           err,
+                              const tokenize_options &requested) noexcept {
+  std::string     key = hl::tu_cache::make_key(buf_name, argc, argv);
+  tu_cache::entry entry;
+  bool            found = cache.take(key, entry);
+  hl::token_list  retval;
+
+  // translation unit is taken before parse slot, so waiting for it doesn't
+  // hold the slot
+  hl::parse_limit::scoped_slot slot{requested.background};
+  tokenize_options             options = start_budget(requested);
+
+  if (is_cancelled(options.cancel)) {
+    if (found) {
+      cache.put(key, std::move(entry));
+    }
+
+    err = CANCELLED_ERROR;
+    return hl::token_list{};
+  }
+
+  if (is_over_budget(options, nullptr)) {
+    if (found) {
+      cache.put(key, std::move(entry));
+    }
+
+    err = BUDGET_ERROR;
+    return hl::token_list{};
+  }
+
+  if (found) {
+    found = reparse(entry, buf_body);
+  }
+
+  if (found == false) {
+    CXTranslationUnit translation_unit = nullptr;
+    CXUnsavedFile     unsaved_file;
+    unsaved_file.Filename = buf_name;
+    unsaved_file.Contents = buf_body.c_str();
+    unsaved_file.Length   = buf_body.size();
+
+    hl::metrics::scoped_timer timer{hl::metrics::stage::parse};
+    CXErrorCode error_code = clang_parseTranslationUnit2(
+        cache.index(),
+        buf_name,
+        argv,
+        argc,
+        &unsaved_file,
+        1,
+        cache.parse_options(),
+        &translation_unit);
+    timer.stop();
+    if (error_code != CXError_Success) {
+      cache.release(key);
+      err = clang_errorToString(error_code);
+      return hl::token_list{};
+    }
+
+    entry.translation_unit = translation_unit;
+    entry.filename         = buf_name;
+
+    if (options.includes != nullptr) {
+      get_includes(translation_unit, *options.includes);
+    }
+  }
+
+  // libclang can not interrupt parsing, so budgets are checked after it.
+  // Translation unit exceeded a budget is not cached for freeing its memory
+  if (is_over_budget(options, entry.translation_unit)) {
+    clang_disposeTranslationUnit(entry.translation_unit);
+    cache.release(key);
+    err = BUDGET_ERROR;
+    return hl::token_list{};
+  }
+
+  // previous tokens can be reused only if included files were not changed
+  uint64_t stamp = 0;
+  if (options.incremental) {
+    stamp = get_includes_stamp(entry.translation_unit);
+  }
+  if (found && stamp != entry.includes_stamp) {
+    entry.body.clear();
+    entry.tokens.clear();
+  }
+
+  // incremental annotation is possible only for whole buffer
+  bool whole_buffer = options.begin_line == 0 && options.end_line == 0;
+  if (found == false || whole_buffer == false || options.incremental == false ||
+      tokenize_incremental(entry.translation_unit,
+                           entry,
+                           buf_body,
+                           options,
+                           retval,
+                           err) == false) {
+    retval = tokenize_translation_unit(entry.translation_unit,
+                                       entry.filename.c_str(),
+                                       options,
+                                       err,
+                                       false);
+  }
+
+  if (options.dependencies != nullptr && err.empty()) {
+    get_dependencies(entry.translation_unit, *options.dependencies);
+  }
+
+  if (options.incremental && whole_buffer && err.empty()) {
+    entry.body           = buf_body;
+    entry.tokens         = retval;
+    entry.includes_stamp = stamp;
+  } else if (err.empty() == false) {
+    entry.body.clear();
+    entry.tokens.clear();
+  }
+
+  cache.put(key, std::move(entry));
+  return retval;
+}
+
+hl::token_list
+clang_tokenize_lexical(const hl::tu_cache &     cache,
+                       const char *            buf_name,
+                       const std::string &     buf_body,
+                       int                     argc,
+                       const char *            argv[],
+                       std::string &           err,
+                       const tokenize_options &requested) noexcept {
+  hl::token_list    retval;
+  CXTranslationUnit translation_unit = nullptr;
+  CXErrorCode       error_code;
+  CXUnsavedFile     unsaved_file;
+
+  hl::parse_limit::scoped_slot slot{requested.background};
+  tokenize_options             options = start_budget(requested);
+  options.incremental                  = false;
+  options.includes                     = nullptr;
+
+  if (is_cancelled(options.cancel)) {
+    err = CANCELLED_ERROR;
+    return retval;
+  }
+
+  if (is_over_budget(options, nullptr)) {
+    err = BUDGET_ERROR;
+    return retval;
+  }
+
+  unsaved_file.Filename = buf_name;
+  unsaved_file.Contents = buf_body.c_str();
+  unsaved_file.Length   = buf_body.size();
+
+  hl::metrics::scoped_timer timer{hl::metrics::stage::parse};
+  error_code = clang_parseTranslationUnit2(cache.index(),
+                                           buf_name,
+                                           argv,
+                                           argc,
+                                           &unsaved_file,
+                                           1,
+                                           LEXICAL_PARSE_OPTIONS,
+                                           &translation_unit);
+  timer.stop();
+  if (error_code != CXError_Success) {
+    err = clang_errorToString(error_code);
+    return retval;
+  }
+
+  // huge buffer can exceed budgets even without included files
+  if (is_over_budget(options, translation_unit)) {
+    clang_disposeTranslationUnit(translation_unit);
+    err = BUDGET_ERROR;
+    return retval;
+  }
+
+  retval = tokenize_translation_unit(translation_unit,
+                                     buf_name,
+                                     options,
+                                     err,
+                                     true);
+
+  clang_disposeTranslationUnit(translation_unit);
+  return retval;
+}
+
+bool clang_reparse(hl::tu_cache &            cache,
+                   const char *              buf_name,
+                   const std::string &       buf_body,
+                   int                       argc,
+                   const char *              argv[],
+                   std::vector<std::string> &includes) noexcept {
+  std::string     key = hl::tu_cache::make_key(buf_name, argc, argv);
+  tu_cache::entry entry;
+
+  if (cache.take(key, entry) == false) {
+    return false;
+  }
+
+  hl::parse_limit::scoped_slot slot{true};
+  if (reparse(entry, buf_body) == false) {
+    cache.release(key);
+    return false;
+  }
+
+  // tokens of previous tokenization can be changed by changed headers
+  entry.body.clear();
+  entry.tokens.clear();
+
+  get_includes(entry.translation_unit, includes);
+  cache.put(key, std::move(entry));
+  return true;
+}
+} // namespace hl
+
+
+static bool is_cancelled(const hl::cancel_callback &callback) noexcept {
+  return callback && callback();
+}
+
+static bool
+is_over_budget(const hl::tokenize_options &options,
+               CXTranslationUnit           translation_unit) noexcept {
+  bool retval = std::chrono::steady_clock::now() > options.deadline;
+  if (retval == false && translation_unit != nullptr &&
+      options.memory_budget != 0) {
+    retval = hl::tu_cache::memory_usage(translation_unit) >
+             options.memory_budget;
+  }
+
+  if (retval && options.exceeded != nullptr) {
+    *options.exceeded = true;
+  }
+
+  return retval;
+}
+
+static hl::tokenize_options
+start_budget(const hl::tokenize_options &options) noexcept {
+  hl::tokenize_options retval = options;
+  if (options.time_budget != 0) {
+    retval.deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds{options.time_budget};
+  }
+  return retval;
+}
+
+static bool reparse(hl::tu_cache::entry &entry,
+                    const std::string &  buf_body) noexcept {
+  CXUnsavedFile unsaved_file;
+  unsaved_file.Filename = entry.filename.c_str();
+  unsaved_file.Contents = buf_body.c_str();
+  unsaved_file.Length   = buf_body.size();
+
+  hl::metrics::scoped_timer timer{hl::metrics::stage::reparse};
+  int error_code = clang_reparseTranslationUnit(
+      entry.translation_unit,
+      1,
+      &unsaved_file,
+      clang_defaultReparseOptions(entry.translation_unit));
+  timer.stop();
+  if (error_code != CXError_Success) {
+    // after failed reparse translation unit can be used only for disposing
+    clang_disposeTranslationUnit(entry.translation_unit);
+    return false;
+  }
+
+  return true;
+}
+
+static void get_includes(CXTranslationUnit         translation_unit,
+                         std::vector<std::string> &includes) noexcept {
+  auto visitor = [](CXFile            included_file,
+                    CXSourceLocation *inclusion_stack,
+                    unsigned          include_len,
+                    CXClientData      client_data) {
+    (void)inclusion_stack;
+    // main file has empty stack
+    if (include_len == 0) {
+      return;
+    }
+
+    std::vector<std::string> *files =
+        static_cast<std::vector<std::string> *>(client_data);
+    CXString filename = clang_getFileName(included_file);
+    if (clang_getCString(filename) != nullptr) {
+      files->emplace_back(clang_getCString(filename));
+    }
+    clang_disposeString(filename);
+  };
+
+  includes.clear();
+  clang_getInclusions(translation_unit, visitor, &includes);
+
+  std::sort(includes.begin(), includes.end());
+  includes.erase(std::unique(includes.begin(), includes.end()),
+                 includes.end());
+}
+
+static uint64_t
+get_includes_stamp(CXTranslationUnit translation_unit) noexcept {
+  auto visitor = [](CXFile            included_file,
+                    CXSourceLocation *inclusion_stack,
+                    unsigned          include_len,
+                    CXClientData      client_data) {
+    (void)inclusion_stack;
+    if (include_len == 0) {
+      return;
+    }
+
+    uint64_t *stamp    = static_cast<uint64_t *>(client_data);
+    CXString  filename = clang_getFileName(included_file);
+    if (clang_getCString(filename) != nullptr) {
+      *stamp = hl::hash_string(clang_getCString(filename), *stamp);
+    }
+    clang_disposeString(filename);
+
+    *stamp = hl::hash_string(std::to_string(clang_getFileTime(included_file)),
+                             *stamp);
+  };
+
+  uint64_t retval = hl::hash_seed;
+  clang_getInclusions(translation_unit, visitor, &retval);
+  return retval;
+}
+
+static void get_dependencies(CXTranslationUnit translation_unit,
+                             hl::file_stamp &  dependencies) noexcept {
+  using file_map = std::map<std::string, long long>;
+
+  auto visitor = [](CXFile            included_file,
+                    CXSourceLocation *inclusion_stack,
+                    unsigned          include_len,
+                    CXClientData      client_data) {
+    (void)inclusion_stack;
+    if (include_len == 0) {
+      return;
+    }
+
+    file_map *files    = static_cast<file_map *>(client_data);
+    CXString  filename = clang_getFileName(included_file);
+    if (clang_getCString(filename) != nullptr) {
+      (*files)[clang_getCString(filename)] = clang_getFileTime(included_file);
+    }
+    clang_disposeString(filename);
+  };
+
+  // map sorts files, so stamp doesn't depend on order of inclusions
+  file_map files;
+  clang_getInclusions(translation_unit, visitor, &files);
+
+  dependencies.files.clear();
+  dependencies.stamp = hl::hash_seed;
+  for (const auto &file : files) {
+    dependencies.files.emplace_back(file.first);
+    dependencies.stamp =
+        hl::hash_file_time(file.first, file.second, dependencies.stamp);
   }
+}
 
-  for (unsigned i = 0; i < clang_getNumDiagnostics(translation_unit); ++i) {
+static hl::token_list
+tokenize_translation_unit(CXTranslationUnit           translation_unit,
+                          const char *                filename,
+                          const hl::tokenize_options &options,
+                          std::string &               err,
+                          bool                        ignore_fatal) noexcept {
+  hl::token_list        retval;
+  CXFile                tru_file;
+  const char *          file_contents;
+  size_t                file_size;
+  size_t                begin_offset;
+  size_t                end_offset;
+  CXSourceLocation      begin_loc;
+  CXSourceLocation      end_loc;
+  CXSourceRange         range;
+  CXToken *             cx_tokens  = nullptr;
+  unsigned int          num_tokens = 0;
+  std::vector<CXCursor> cursors;
+  location_resolver     resolver;
+
+  std::chrono::steady_clock::time_point stage_start;
+
+  for (unsigned i = 0;
+       ignore_fatal == false && i < clang_getNumDiagnostics(translation_unit);
+       ++i) {
     CXDiagnostic diag = clang_getDiagnostic(translation_unit, i);
 
     switch (clang_getDiagnosticSeverity(diag)) {
@@ -54,6 +646,7 @@ hl::token_list clang_tokenize(const char * filename,
           clang_formatDiagnostic(diag, CXDiagnostic_DisplayCategoryName);
       err = clang_getCString(spelling);
       clang_disposeString(spelling);
+      clang_disposeDiagnostic(diag);
 
       goto Finish;
     } break;
@@ -67,12 +660,27 @@ hl::token_list clang_tokenize(const char * filename,
   tru_file = clang_getFile(translation_unit, filename);
   if (tru_file == nullptr) {
     err = "can't get handling file from translation unit";
+    goto Finish;
   }
 
-  clang_getFileContents(translation_unit, tru_file, &file_offset);
+  file_contents = clang_getFileContents(translation_unit, tru_file, &file_size);
+
+  // tokenize and annotate only requested lines
+  begin_offset = 0;
+  end_offset   = file_size;
+  if (file_contents != nullptr && options.begin_line > 1) {
+    begin_offset = line_offset(file_contents, file_size, options.begin_line);
+  }
+  if (file_contents != nullptr && options.end_line != 0) {
+    end_offset = line_offset(file_contents, file_size, options.end_line + 1);
+  }
+  if (begin_offset >= end_offset) {
+    goto Finish;
+  }
 
-  begin_loc = clang_getLocationForOffset(translation_unit, tru_file, 0);
-  end_loc = clang_getLocationForOffset(translation_unit, tru_file, file_offset);
+  begin_loc =
+      clang_getLocationForOffset(translation_unit, tru_file, begin_offset);
+  end_loc = clang_getLocationForOffset(translation_unit, tru_file, end_offset);
 
   range = clang_getRange(begin_loc, end_loc);
 
@@ -86,10 +694,39 @@ hl::token_list clang_tokenize(const char * filename,
   }
 
 
-  // get annotated tokens
+  // get annotated tokens, annotation can take a lot of time, so it is
+  // splitted by chunks for checking cancellation
   cursors.resize(num_tokens);
-  clang_annotateTokens(translation_unit, cx_tokens, num_tokens, cursors.data());
+  stage_start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < num_tokens; i += ANNOTATE_CHUNK_SIZE) {
+    if (is_cancelled(options.cancel)) {
+      err = CANCELLED_ERROR;
+      goto Finish;
+    }
+
+    if (is_over_budget(options, nullptr)) {
+      err = BUDGET_ERROR;
+      goto Finish;
+    }
+
+    unsigned chunk_size = std::min(num_tokens - i, ANNOTATE_CHUNK_SIZE);
+    clang_annotateTokens(translation_unit,
+                         cx_tokens + i,
+                         chunk_size,
+                         cursors.data() + i);
+  }
 
+  // tokens are ordered by offsets, so lines are counted from begin of range
+  resolver.data       = file_contents;
+  resolver.size       = file_contents != nullptr ? file_size : 0;
+  resolver.line       = options.begin_line > 1 ? options.begin_line : 1;
+  resolver.line_begin = begin_offset;
+
+  hl::metrics::record(hl::metrics::stage::annotate,
+                      std::chrono::steady_clock::now() - stage_start);
+  stage_start = std::chrono::steady_clock::now();
+
+  retval.reserve(num_tokens);
   for (size_t i = 0; i < num_tokens; ++i) {
     CXToken &cx_token = cx_tokens[i];
 
@@ -98,25 +735,43 @@ hl::token_list clang_tokenize(const char * filename,
       continue;
     }
 
-    CXCursor &     cursor   = cursors[i];
-    std::string    group    = get_token_group(cursor);
-    token_location location = get_token_location(translation_unit, cx_token);
-    retval.emplace_back(token{group, location});
+    CXCursor &         cursor = cursors[i];
+    hl::group_id       group  = get_token_group(cursor);
+    hl::token_location location;
+    if (resolve_location(resolver, translation_unit, cx_token, location) ==
+        false) {
+      location = get_token_location(translation_unit, cx_token);
+    }
+    retval.emplace_back(hl::token{group, location});
   }
+  hl::metrics::record(hl::metrics::stage::classify,
+                      std::chrono::steady_clock::now() - stage_start);
 
 
 Finish:
   if (cx_tokens) {
     clang_disposeTokens(translation_unit, cx_tokens, num_tokens);
   }
-  clang_disposeIndex(index);
-  clang_disposeTranslationUnit(translation_unit);
 
   return retval;
 }
-} // namespace hl
 
 
+static size_t
+line_offset(const char *data, size_t size, unsigned int line) noexcept {
+  const char *pos = data;
+  const char *end = data + size;
+  for (; line > 1 && pos != end; --line) {
+    pos = static_cast<const char *>(memchr(pos, '\n', end - pos));
+    if (pos == nullptr) {
+      return size;
+    }
+    ++pos;
+  }
+
+  return pos - data;
+}
+
 static const char *clang_errorToString(CXErrorCode code) noexcept {
   switch (code) {
   case CXError_Failure:
@@ -135,13 +790,57 @@ static const char *clang_errorToString(CXErrorCode code) noexcept {
 }
 
 
-static std::string get_token_group(const CXCursor &cursor) noexcept {
+static hl::group_id get_token_group(const CXCursor &cursor) noexcept {
   CXTypeKind   type_kind   = clang_getCursorType(cursor).kind;
   CXCursorKind cursor_kind = clang_getCursorKind(cursor);
 
   return map_token_kind(cursor_kind, type_kind);
 }
 
+static bool is_identifier_char(unsigned char ch) noexcept {
+  // all non ascii characters are accepted as part of utf-8 identifiers
+  return isalnum(ch) || ch == '_' || ch == '$' || ch >= 0x80;
+}
+
+static bool resolve_location(location_resolver & resolver,
+                             CXTranslationUnit   translation_unit,
+                             CXToken             token,
+                             hl::token_location &location) noexcept {
+  CXSourceLocation begin = clang_getTokenLocation(translation_unit, token);
+
+  // only offset is requested, so libclang doesn't look up line and column
+  unsigned int offset = 0;
+  clang_getFileLocation(begin, nullptr, nullptr, nullptr, &offset);
+  if (offset < resolver.line_begin || offset >= resolver.size) {
+    return false;
+  }
+
+  const char *data = resolver.data;
+  const char *pos  = data + resolver.line_begin;
+  const char *end  = data + offset;
+  while ((pos = static_cast<const char *>(memchr(pos, '\n', end - pos)))) {
+    ++resolver.line;
+    resolver.line_begin = ++pos - data;
+  }
+
+  size_t token_end = offset;
+  while (token_end != resolver.size && is_identifier_char(data[token_end])) {
+    ++token_end;
+  }
+
+  // escaped new lines and universal character names are resolved by libclang
+  if (token_end == offset ||
+      (token_end != resolver.size && data[token_end] == '\\')) {
+    return false;
+  }
+
+  location = hl::token_location{
+      resolver.line,
+      static_cast<unsigned int>(offset - resolver.line_begin + 1),
+      static_cast<unsigned int>(token_end - offset)};
+  return true;
+}
+
 static hl::token_location get_token_location(CXTranslationUnit translation_unit,
                                              CXToken           token) noexcept {
   CXSourceRange    token_range = clang_getTokenExtent(translation_unit, token);
@@ -158,8 +857,8 @@ static hl::token_location get_token_location(CXTranslationUnit translation_unit,
   return hl::token_location{line, column, endOffset - beginOffset};
 }
 
-static std::string map_token_kind(const CXCursorKind cursor_kind,
-                                  const CXTypeKind   type_kind) noexcept {
+static hl::group_id map_token_kind(const CXCursorKind cursor_kind,
+                                   const CXTypeKind   type_kind) noexcept {
   switch (cursor_kind) {
   case CXCursor_DeclRefExpr:
   case CXCursor_VarDecl:
@@ -168,13 +867,19 @@ static std::string map_token_kind(const CXCursorKind cursor_kind,
     break;
   }
 
-  CXString    cursorKindSpelling = clang_getCursorKindSpelling(cursor_kind);
-  std::string retval             = clang_getCString(cursorKindSpelling);
-  clang_disposeString(cursorKindSpelling);
-  return retval;
+  static thread_local std::vector<hl::group_id> cursor_kind_groups;
+  return spelled_group(cursor_kind_groups,
+                       cursor_kind,
+                       &clang_getCursorKindSpelling);
 }
 
-static std::string map_type_kind(CXTypeKind const type_kind) noexcept {
+static hl::group_id map_type_kind(CXTypeKind const type_kind) noexcept {
+  static const hl::group_id variable_group      = hl::intern_group("Variable");
+  static const hl::group_id member_group        = hl::intern_group("Member");
+  static const hl::group_id enum_constant_group =
+      hl::intern_group("EnumConstant");
+  static const hl::group_id function_group = hl::intern_group("Function");
+
   switch (type_kind) {
   case CXType_Void:
   case CXType_Bool:
@@ -230,24 +935,271 @@ static std::string map_type_kind(CXTypeKind const type_kind) noexcept {
   case CXType_DependentSizedArray:
   case CXType_Auto:
   case CXType_Elaborated:
-    return "Variable";
+    return variable_group;
 
   case CXType_MemberPointer:
-    return "Member";
+    return member_group;
 
   case CXType_Enum:
-    return "EnumConstant";
+    return enum_constant_group;
 
   case CXType_FunctionNoProto:
   case CXType_FunctionProto:
-    return "Function";
+    return function_group;
 
   default:
     break;
   }
 
-  CXString    typeSpelling = clang_getTypeKindSpelling(type_kind);
-  std::string retval       = clang_getCString(typeSpelling);
-  clang_disposeString(typeSpelling);
+  static thread_local std::vector<hl::group_id> type_kind_groups;
+  return spelled_group(type_kind_groups, type_kind, &clang_getTypeKindSpelling);
+}
+
+template <typename Kind>
+static hl::group_id spelled_group(std::vector<hl::group_id> &table,
+                                  Kind                       kind,
+                                  CXString (*spelling)(Kind)) noexcept {
+  size_t index = static_cast<size_t>(kind);
+  if (index >= table.size()) {
+    table.resize(index + 1, NO_GROUP);
+  }
+
+  if (table[index] == NO_GROUP) {
+    CXString kind_spelling = spelling(kind);
+    table[index]           = hl::intern_group(clang_getCString(kind_spelling));
+    clang_disposeString(kind_spelling);
+  }
+
+  return table[index];
+}
+
+static bool tokenize_incremental(CXTranslationUnit           translation_unit,
+                                 const hl::tu_cache::entry & entry,
+                                 const std::string &         buf_body,
+                                 const hl::tokenize_options &options,
+                                 hl::token_list &            tokens,
+                                 std::string &               err) noexcept {
+  const std::string &    prev_body = entry.body;
+  std::vector<size_t>    prev_starts;
+  std::vector<size_t>    cur_starts;
+  unsigned int           prev_count = 0;
+  unsigned int           cur_count  = 0;
+  unsigned int           prefix     = 0; // count of same lines at begin
+  unsigned int           suffix     = 0; // count of same lines at end
+  std::set<std::string>  words;
+  std::set<unsigned int> lines; // which must be annotated, in current body
+
+  std::vector<std::pair<unsigned int, unsigned int>> ranges;
+
+  if (entry.tokens.empty() || prev_body.empty()) {
+    return false;
+  }
+
+  prev_starts = line_starts(prev_body);
+  cur_starts  = line_starts(buf_body);
+  prev_count  = prev_starts.size() - 1;
+  cur_count   = cur_starts.size() - 1;
+
+  auto same_lines = [&](unsigned int prev_line, unsigned int cur_line) {
+    size_t prev_begin = prev_starts[prev_line - 1];
+    size_t cur_begin  = cur_starts[cur_line - 1];
+    size_t size       = prev_starts[prev_line] - prev_begin;
+    return size == cur_starts[cur_line] - cur_begin &&
+           memcmp(prev_body.data() + prev_begin,
+                  buf_body.data() + cur_begin,
+                  size) == 0;
+  };
+
+  while (prefix < prev_count && prefix < cur_count &&
+         same_lines(prefix + 1, prefix + 1)) {
+    ++prefix;
+  }
+  while (prefix + suffix < prev_count && prefix + suffix < cur_count &&
+         same_lines(prev_count - suffix, cur_count - suffix)) {
+    ++suffix;
+  }
+
+  // changed lines are [prefix + 1, count - suffix] in both bodies
+  if (collect_words(prev_body,
+                    prev_starts,
+                    prefix + 1,
+                    prev_count - suffix,
+                    words) == false ||
+      collect_words(buf_body,
+                    cur_starts,
+                    prefix + 1,
+                    cur_count - suffix,
+                    words) == false) {
+    return false;
+  }
+
+  for (unsigned int line = prefix + 1; line <= cur_count - suffix; ++line) {
+    lines.emplace(line);
+  }
+
+  // classification of identifiers from changed lines can be changed in all
+  // other lines
+  for (const hl::token &tok : entry.tokens) {
+    unsigned int line = tok.pos[0];
+    if (line > prefix && line <= prev_count - suffix) {
+      continue;
+    }
+    if (line == 0 || line > prev_count || tok.pos[1] == 0) {
+      return false;
+    }
+
+    size_t offset = prev_starts[line - 1] + tok.pos[1] - 1;
+    if (offset + tok.pos[2] > prev_starts[line]) {
+      return false;
+    }
+
+    if (words.count(prev_body.substr(offset, tok.pos[2])) != 0) {
+      lines.emplace(line <= prefix ? line : line + cur_count - prev_count);
+    }
+  }
+
+  if (lines.size() > cur_count / INCREMENTAL_MAX_PART) {
+    return false;
+  }
+
+  for (unsigned int line : lines) {
+    if (ranges.empty() == false &&
+        line <= ranges.back().second + INCREMENTAL_LINE_GAP) {
+      ranges.back().second = line;
+    } else {
+      ranges.emplace_back(line, line);
+    }
+  }
+  if (ranges.size() > INCREMENTAL_MAX_RANGES) {
+    return false;
+  }
+
+  // tokens of previous result (for unchanged lines) and new tokens of ranges
+  // are merged by lines, so result is still sorted
+  tokens.clear();
+  tokens.reserve(entry.tokens.size());
+  auto prev_iter = entry.tokens.begin();
+  auto append_previous = [&](unsigned int until_line) {
+    for (; prev_iter != entry.tokens.end(); ++prev_iter) {
+      unsigned int line = prev_iter->pos[0];
+      if (line > prefix && line <= prev_count - suffix) {
+        continue; // changed line
+      }
+
+      line = line <= prefix ? line : line + cur_count - prev_count;
+      if (line >= until_line) {
+        break;
+      }
+
+      tokens.emplace_back(*prev_iter);
+      tokens.back().pos[0] = line;
+    }
+  };
+  auto skip_previous = [&](unsigned int until_line) {
+    for (; prev_iter != entry.tokens.end(); ++prev_iter) {
+      unsigned int line = prev_iter->pos[0];
+      if (line > prefix && line <= prev_count - suffix) {
+        continue;
+      }
+
+      line = line <= prefix ? line : line + cur_count - prev_count;
+      if (line > until_line) {
+        break;
+      }
+    }
+  };
+
+  for (const auto &range : ranges) {
+    hl::tokenize_options range_options = options;
+    range_options.begin_line           = range.first;
+    range_options.end_line             = range.second;
+
+    hl::token_list range_tokens =
+        tokenize_translation_unit(translation_unit,
+                                  entry.filename.c_str(),
+                                  range_options,
+                                  err,
+                                  false);
+    if (err.empty() == false) {
+      tokens.clear();
+      return true;
+    }
+
+    append_previous(range.first);
+    skip_previous(range.second);
+    tokens.insert(tokens.end(), range_tokens.begin(), range_tokens.end());
+  }
+  append_previous(cur_count + 1);
+
+  return true;
+}
+
+static std::vector<size_t> line_starts(const std::string &text) {
+  std::vector<size_t> retval{0};
+  size_t              pos = text.find('\n');
+  while (pos != std::string::npos) {
+    retval.emplace_back(pos + 1);
+    pos = text.find('\n', pos + 1);
+  }
+
+  // text without new line at end has not empty last line
+  if (retval.back() != text.size()) {
+    retval.emplace_back(text.size());
+  }
   return retval;
 }
+
+static bool collect_words(const std::string &        text,
+                          const std::vector<size_t> &starts,
+                          unsigned int               begin_line,
+                          unsigned int               end_line,
+                          std::set<std::string> &    words) {
+  if (begin_line > end_line) {
+    return true;
+  }
+
+  size_t begin  = starts[begin_line - 1];
+  size_t end    = starts[end_line];
+  int    braces = 0;
+  int    parens = 0;
+  for (size_t pos = begin; pos < end;) {
+    char ch   = text[pos];
+    char next = pos + 1 < end ? text[pos + 1] : '\0';
+    switch (ch) {
+    case '#':
+    case '"':
+    case '\'':
+    case '\\':
+      return false;
+    case '/':
+    case '*':
+      if (next == (ch == '/' ? '*' : '/')) {
+        return false;
+      }
+      break;
+    case '{':
+    case '}':
+      braces += ch == '{' ? 1 : -1;
+      break;
+    case '(':
+    case ')':
+      parens += ch == '(' ? 1 : -1;
+      break;
+    default:
+      break;
+    }
+
+    if (is_identifier_char(ch) == false) {
+      ++pos;
+      continue;
+    }
+
+    size_t word_begin = pos;
+    while (pos < end && is_identifier_char(text[pos])) {
+      ++pos;
+    }
+    words.emplace(text, word_begin, pos - word_begin);
+  }
+
+  return braces == 0 && parens == 0;
+}
@@ -0,0 +1,167 @@
+#include "compile_db.hpp"
+#include "c_logs/log.h"
+#include <cstring>
+#include <sys/stat.h>
+
+
+#define DB_FILENAME    "compile_commands.json"
+#define CHECK_INTERVAL std::chrono::seconds{1}
+
+
+/**\return modification time of the file, or 0 if file not exists
+ */
+static time_t get_modify_time(const std::string &filename) noexcept;
+
+static std::string to_string(CXString str);
+
+/**\return true if the argument is output with joined file: `-oX` or `-o=X`
+ */
+static bool is_joined_output(const std::string &arg);
+
+/**\return flags for libclang: without compiler, output and the file itself
+ */
+static hl::compile_flags_ptr make_flags(CXCompileCommand   command,
+                                        const std::string &filename);
+
+
+namespace hl {
+compile_db::compile_db(const std::string &directory) noexcept
+    : directory_{directory}
+    , db_file_{directory + "/" DB_FILENAME}
+    , db_{nullptr}
+    , modify_time_{0} {
+  std::lock_guard<std::mutex> lock{mutex_};
+  this->update();
+}
+
+compile_db::~compile_db() noexcept {
+  if (db_ != nullptr) {
+    clang_CompilationDatabase_dispose(db_);
+  }
+}
+
+compile_flags_ptr compile_db::get(const std::string &filename) noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  this->update();
+  if (db_ == nullptr) {
+    return nullptr;
+  }
+
+  // files without flags are also cached, so database is asked only once
+  auto found = flags_.find(filename);
+  if (found != flags_.end()) {
+    return found->second;
+  }
+
+  compile_flags_ptr retval;
+  CXCompileCommands commands =
+      clang_CompilationDatabase_getCompileCommands(db_, filename.c_str());
+  if (commands != nullptr) {
+    if (clang_CompileCommands_getSize(commands) != 0) {
+      retval = make_flags(clang_CompileCommands_getCommand(commands, 0),
+                          filename);
+    }
+    clang_CompileCommands_dispose(commands);
+  }
+
+  flags_.emplace(filename, retval);
+  return retval;
+}
+
+void compile_db::update() noexcept {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (db_ != nullptr && now - check_time_ < CHECK_INTERVAL) {
+    return;
+  }
+  check_time_ = now;
+
+  time_t modify_time = get_modify_time(db_file_);
+  if (modify_time == modify_time_) {
+    return;
+  }
+
+  if (db_ != nullptr) {
+    LOG_INFO("compilation database changed: %s", db_file_.c_str());
+    clang_CompilationDatabase_dispose(db_);
+    db_ = nullptr;
+  }
+  flags_.clear();
+  modify_time_ = modify_time;
+
+  if (modify_time == 0) {
+    LOG_WARNING("compilation database not found: %s", db_file_.c_str());
+    return;
+  }
+
+  CXCompilationDatabase_Error error = CXCompilationDatabase_NoError;
+  db_ = clang_CompilationDatabase_fromDirectory(directory_.c_str(), &error);
+  if (error != CXCompilationDatabase_NoError) {
+    LOG_ERROR("can't load compilation database: %s", db_file_.c_str());
+    if (db_ != nullptr) {
+      clang_CompilationDatabase_dispose(db_);
+      db_ = nullptr;
+    }
+  }
+}
+} // namespace hl
+
+
+static time_t get_modify_time(const std::string &filename) noexcept {
+  struct stat file_stat;
+  if (stat(filename.c_str(), &file_stat) != 0) {
+    return 0;
+  }
+
+  return file_stat.st_mtime;
+}
+
+static std::string to_string(CXString str) {
+  const char *chars  = clang_getCString(str);
+  std::string retval = chars != nullptr ? chars : "";
+  clang_disposeString(str);
+  return retval;
+}
+
+static bool is_joined_output(const std::string &arg) {
+  // other flags, which start by `-o`, are `-objc...`, `-objcmt-...` and
+  // `-object`
+  return arg.size() > 2 && arg.compare(0, 2, "-o") == 0 &&
+         arg.compare(0, 4, "-obj") != 0;
+}
+
+static hl::compile_flags_ptr make_flags(CXCompileCommand   command,
+                                        const std::string &filename) {
+  std::shared_ptr<hl::compile_flags> retval =
+      std::make_shared<hl::compile_flags>();
+  std::vector<std::string> &args = retval->args;
+
+  // relative paths in flags are relative to directory of the command
+  args.emplace_back("-working-directory=" +
+                    to_string(clang_CompileCommand_getDirectory(command)));
+
+  std::string command_file =
+      to_string(clang_CompileCommand_getFilename(command));
+
+  // first argument is compiler
+  unsigned count = clang_CompileCommand_getNumArgs(command);
+  for (unsigned i = 1; i < count; ++i) {
+    std::string arg = to_string(clang_CompileCommand_getArg(command, i));
+    if (arg == "-o" && i + 1 < count) {
+      ++i;
+      continue;
+    } else if (is_joined_output(arg) || arg == "-c" || arg == command_file ||
+               arg == filename) {
+      continue;
+    }
+
+    args.emplace_back(std::move(arg));
+  }
+
+  retval->argv.reserve(args.size());
+  for (const std::string &arg : args) {
+    retval->argv.emplace_back(arg.c_str());
+  }
+
+  return retval;
+}
@@ -0,0 +1,232 @@
+#include "disk_cache.hpp"
+#include "c_logs/log.h"
+#include "hash.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define FILE_MAGIC     "HLT1"
+#define MAGIC_SIZE     4
+#define FILE_EXTENSION ".tokens"
+
+
+// layout of file (native byte order):
+// magic, hash of content (uint64), count of groups (uint32),
+// count of tokens (uint32), groups as length (uint32) and name,
+// tokens as group index and location (4 x uint32)
+struct file_header {
+  char     magic[MAGIC_SIZE];
+  uint64_t content_hash;
+  uint32_t group_count;
+  uint32_t token_count;
+};
+
+
+static void append_uint32(std::string &out, uint32_t value);
+
+/**\brief read value and move forward the position
+ *
+ * \return false if there is no enough data
+ */
+static bool read_uint32(const char *&pos, const char *end, uint32_t &value);
+
+/**\brief restore tokens from content of file
+ */
+static bool parse_tokens(const char *    data,
+                         size_t          size,
+                         uint64_t        content_hash,
+                         hl::token_list &tokens);
+
+
+namespace hl {
+disk_cache::disk_cache(const std::string &directory) noexcept
+    : directory_{directory} {
+}
+
+bool disk_cache::load(const std::string &key,
+                      const std::string &buf_body,
+                      token_list &       tokens) const noexcept {
+  std::string path   = this->filename(key);
+  void *      data   = MAP_FAILED;
+  bool        retval = false;
+  struct stat file_stat;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(file_header)) {
+    goto Finish;
+  }
+
+  data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    LOG_WARNING("can't map file %s: %s", path.c_str(), strerror(errno));
+    goto Finish;
+  }
+
+  retval = parse_tokens(static_cast<const char *>(data),
+                        file_stat.st_size,
+                        hl::hash_string(buf_body),
+                        tokens);
+  if (retval == false) {
+    tokens.clear();
+  }
+
+Finish:
+  if (data != MAP_FAILED) {
+    munmap(data, file_stat.st_size);
+  }
+  close(fd);
+  return retval;
+}
+
+void disk_cache::store(const std::string &key,
+                       const std::string &buf_body,
+                       const token_list & tokens) const noexcept {
+  std::string              path = this->filename(key);
+  std::string              temp = path + ".XXXXXX";
+  std::string              out;
+  std::vector<uint32_t>    indexes(group_count(), UINT32_MAX); // by group ids
+  std::vector<std::string> groups;
+  file_header              header;
+  size_t                   written = 0;
+
+  // only used groups are stored
+  for (const hl::token &tok : tokens) {
+    if (indexes[tok.group] == UINT32_MAX) {
+      indexes[tok.group] = groups.size();
+      groups.emplace_back(group_name(tok.group));
+    }
+  }
+
+  memcpy(header.magic, FILE_MAGIC, MAGIC_SIZE);
+  header.content_hash = hl::hash_string(buf_body);
+  header.group_count  = groups.size();
+  header.token_count  = tokens.size();
+
+  out.reserve(sizeof(header) + tokens.size() * 4 * sizeof(uint32_t));
+  out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const std::string &group : groups) {
+    append_uint32(out, group.size());
+    out.append(group);
+  }
+  for (const hl::token &tok : tokens) {
+    append_uint32(out, indexes[tok.group]);
+    for (unsigned int value : tok.pos) {
+      append_uint32(out, value);
+    }
+  }
+
+  // file is replaced atomically, so readers never see partial result
+  int fd = mkstemp(&temp[0]);
+  if (fd < 0) {
+    LOG_WARNING("can't create file in cache directory %s: %s",
+                directory_.c_str(),
+                strerror(errno));
+    return;
+  }
+
+  while (written != out.size()) {
+    ssize_t count = write(fd, out.data() + written, out.size() - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0) {
+      LOG_WARNING("can't write file %s: %s", temp.c_str(), strerror(errno));
+      close(fd);
+      unlink(temp.c_str());
+      return;
+    }
+
+    written += count;
+  }
+  close(fd);
+
+  if (rename(temp.c_str(), path.c_str()) != 0) {
+    LOG_WARNING("can't rename file %s: %s", temp.c_str(), strerror(errno));
+    unlink(temp.c_str());
+  }
+}
+
+std::string disk_cache::filename(const std::string &key) const {
+  char name[32];
+  snprintf(name,
+           sizeof(name),
+           "%016llx",
+           static_cast<unsigned long long>(hl::hash_string(key)));
+  return directory_ + "/" + name + FILE_EXTENSION;
+}
+} // namespace hl
+
+
+static void append_uint32(std::string &out, uint32_t value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static bool read_uint32(const char *&pos, const char *end, uint32_t &value) {
+  if (static_cast<size_t>(end - pos) < sizeof(value)) {
+    return false;
+  }
+
+  memcpy(&value, pos, sizeof(value));
+  pos += sizeof(value);
+  return true;
+}
+
+static bool parse_tokens(const char *    data,
+                         size_t          size,
+                         uint64_t        content_hash,
+                         hl::token_list &tokens) {
+  const char *              pos = data + sizeof(file_header);
+  const char *              end = data + size;
+  file_header               header;
+  std::vector<hl::group_id> groups;
+
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, FILE_MAGIC, MAGIC_SIZE) != 0 ||
+      header.content_hash != content_hash) {
+    return false;
+  }
+
+  groups.reserve(header.group_count);
+  for (uint32_t i = 0; i < header.group_count; ++i) {
+    uint32_t length = 0;
+    if (read_uint32(pos, end, length) == false ||
+        static_cast<size_t>(end - pos) < length) {
+      return false;
+    }
+
+    groups.emplace_back(hl::intern_group(std::string{pos, length}.c_str()));
+    pos += length;
+  }
+
+  if (static_cast<size_t>(end - pos) / (4 * sizeof(uint32_t)) <
+      header.token_count) {
+    return false;
+  }
+
+  tokens.resize(header.token_count);
+  for (hl::token &tok : tokens) {
+    uint32_t index = 0;
+    read_uint32(pos, end, index);
+    if (index >= groups.size()) {
+      return false;
+    }
+
+    tok.group = groups[index];
+    for (unsigned int &value : tok.pos) {
+      read_uint32(pos, end, value);
+    }
+  }
+
+  return true;
+}
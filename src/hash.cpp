@@ -0,0 +1,40 @@
+#include "hash.hpp"
+
+
+#define FNV_PRIME 1099511628211ull
+
+
+namespace hl {
+uint64_t hash_string(const std::string &str, uint64_t seed) noexcept {
+  uint64_t retval = seed;
+  for (char ch : str) {
+    retval ^= static_cast<unsigned char>(ch);
+    retval *= FNV_PRIME;
+  }
+  return retval;
+}
+
+std::vector<uint64_t> hash_lines(const std::string &str) noexcept {
+  std::vector<uint64_t> retval;
+  uint64_t              line = hash_seed;
+  for (char ch : str) {
+    if (ch == '\n') {
+      retval.push_back(line);
+      line = hash_seed;
+      continue;
+    }
+
+    line ^= static_cast<unsigned char>(ch);
+    line *= FNV_PRIME;
+  }
+  retval.push_back(line);
+
+  return retval;
+}
+
+uint64_t hash_file_time(const std::string &file,
+                        long long          time,
+                        uint64_t           seed) noexcept {
+  return hash_string(std::to_string(time), hash_string(file, seed));
+}
+} // namespace hl
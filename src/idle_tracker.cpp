@@ -0,0 +1,230 @@
+#include "idle_tracker.hpp"
+#include "c_logs/log.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+#define WATCH_MASK                                                             \
+  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM)
+#define EVENTS_SIZE 16 * 1024
+
+
+namespace hl {
+idle_tracker::idle_tracker(std::chrono::milliseconds interval) noexcept
+    : interval_{interval}
+    , inotify_fd_{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+    , timer_fd_{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)} {
+  if (timer_fd_ < 0) {
+    return;
+  }
+
+  // buffers are checked twice per interval, so buffer is reparsed not later
+  // than 1.5 intervals after its latest usage
+  std::chrono::milliseconds period = interval_ / 2;
+  itimerspec                spec;
+  spec.it_interval.tv_sec  = period.count() / 1000;
+  spec.it_interval.tv_nsec = (period.count() % 1000) * 1000000;
+  spec.it_value            = spec.it_interval;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    spec.it_value.tv_nsec = 1000000;
+    spec.it_interval      = spec.it_value;
+  }
+
+  if (timerfd_settime(timer_fd_, 0, &spec, nullptr) != 0) {
+    LOG_ERROR("can't start timer: %s", strerror(errno));
+    close(timer_fd_);
+    timer_fd_ = -1;
+  }
+}
+
+idle_tracker::~idle_tracker() noexcept {
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+  if (timer_fd_ >= 0) {
+    close(timer_fd_);
+  }
+}
+
+bool idle_tracker::valid() const noexcept {
+  return inotify_fd_ >= 0 && timer_fd_ >= 0;
+}
+
+int idle_tracker::inotify_fd() const noexcept {
+  return inotify_fd_;
+}
+
+int idle_tracker::timer_fd() const noexcept {
+  return timer_fd_;
+}
+
+void idle_tracker::touch(const std::string &             key,
+                         const std::string &             buf_name,
+                         std::string &&                  buf_body,
+                         std::vector<std::string> &&     args,
+                         const std::vector<std::string> &includes) {
+  auto found = buffers_.find(key);
+  if (found == buffers_.end()) {
+    found = buffers_.emplace(key, buffer{}).first;
+    found->second.buf_name = buf_name;
+    found->second.args     = std::move(args);
+    found->second.running  = false;
+  }
+
+  buffer &buf  = found->second;
+  buf.buf_body = std::move(buf_body);
+  buf.last_use = std::chrono::steady_clock::now();
+  buf.changed  = false;
+
+  if (includes.empty() == false) {
+    this->watch_includes(key, buf, includes);
+  }
+}
+
+std::set<std::string> idle_tracker::handle_file_changes() {
+  alignas(inotify_event) char events[EVENTS_SIZE];
+  std::set<std::string>       retval;
+
+  while (true) {
+    ssize_t count = read(inotify_fd_, events, sizeof(events));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count <= 0) {
+      break;
+    }
+
+    for (char *pos = events; pos < events + count;) {
+      inotify_event *event = reinterpret_cast<inotify_event *>(pos);
+      pos += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // some events are lost, so all buffers can be changed
+        for (auto &pair : buffers_) {
+          pair.second.changed = true;
+          retval.emplace(pair.first);
+        }
+        continue;
+      }
+
+      if (event->len == 0) {
+        continue;
+      }
+
+      auto found = watched_.find(watched_file{event->wd, event->name});
+      if (found == watched_.end()) {
+        continue;
+      }
+
+      for (const std::string &key : found->second) {
+        LOG_DEBUG("included file %s changed", event->name);
+        buffers_[key].changed = true;
+        retval.emplace(key);
+      }
+    }
+  }
+
+  return retval;
+}
+
+std::list<idle_tracker::job> idle_tracker::idle_jobs(const tu_cache &cache) {
+  std::list<job> retval;
+  uint64_t       ticks = 0;
+
+  if (read(timer_fd_, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+    return retval;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  for (auto iter = buffers_.begin(); iter != buffers_.end();) {
+    buffer &buf = iter->second;
+    if (buf.running || now - buf.last_use < interval_) {
+      ++iter;
+      continue;
+    }
+
+    // translation unit was evicted, so the buffer will be parsed from scratch
+    // by next request anyway
+    if (cache.contains(iter->first) == false) {
+      this->unwatch(iter->first, buf);
+      iter = buffers_.erase(iter);
+      continue;
+    }
+
+    if (buf.changed) {
+      buf.running = true;
+      buf.changed = false;
+      retval.emplace_back(
+          job{iter->first, buf.buf_name, buf.buf_body, buf.args});
+    }
+    ++iter;
+  }
+
+  return retval;
+}
+
+void idle_tracker::finish(const std::string &             key,
+                          const std::vector<std::string> &includes) {
+  auto found = buffers_.find(key);
+  if (found == buffers_.end()) {
+    return;
+  }
+
+  buffer &buf = found->second;
+  buf.running = false;
+  if (includes.empty() == false) {
+    this->watch_includes(key, buf, includes);
+  }
+}
+
+void idle_tracker::watch_includes(const std::string &             key,
+                                  buffer &                        buf,
+                                  const std::vector<std::string> &includes) {
+  this->unwatch(key, buf);
+
+  for (const std::string &include : includes) {
+    size_t      slash     = include.rfind('/');
+    std::string directory = slash == std::string::npos
+                                ? std::string{"."}
+                                : include.substr(0, slash + 1);
+    std::string filename  = include.substr(slash + 1);
+
+    // same watch is returned for same directory, but syscall is avoided
+    auto found = directories_.find(directory);
+    if (found == directories_.end()) {
+      int watch = inotify_add_watch(inotify_fd_, directory.c_str(), WATCH_MASK);
+      if (watch < 0) {
+        LOG_WARNING("can't watch directory %s: %s",
+                    directory.c_str(),
+                    strerror(errno));
+        continue;
+      }
+
+      found = directories_.emplace(directory, watch).first;
+    }
+
+    watched_file file{found->second, filename};
+    watched_[file].emplace(key);
+    buf.files.emplace_back(std::move(file));
+  }
+}
+
+void idle_tracker::unwatch(const std::string &key, buffer &buf) {
+  // watches of directories are kept, because there are not many of them
+  for (const watched_file &file : buf.files) {
+    auto found = watched_.find(file);
+    if (found == watched_.end()) {
+      continue;
+    }
+
+    found->second.erase(key);
+    if (found->second.empty()) {
+      watched_.erase(found);
+    }
+  }
+
+  buf.files.clear();
+}
+} // namespace hl
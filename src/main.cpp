@@ -1,36 +1,57 @@
 #include "c_arg_parser/arg_parser.h"
 #include "c_logs/log.h"
-#include "clang_tokenize.hpp"
 #include "gen/version.h"
-#include "rr_schemes.h"
-#include "token.hpp"
+#include "metrics.hpp"
+#include "parse_limit.hpp"
+#include "tu_cache.hpp"
+#include "worker.hpp"
 #include <arpa/inet.h>
-#include <atomic>
 #include <csignal>
+#include <fcntl.h>
 #include <iostream>
 #include <list>
-#include <nlohmann/json-schema.hpp>
-#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 
-#define ADDRESS   "localhost"
-#define BACKLOG   SOMAXCONN
-#define BUF_SIZE  1024 * 1024 // 1Mb
-#define DELIMITER '\n'
+#define ADDRESS            "127.0.0.1"
+#define BACKLOG            SOMAXCONN
+#define FORK_RETRY_TIMEOUT 1000 // ms
 
 
-std::atomic_bool done{false};
-static void      signal_handler(int val);
+/**\param address IPv4 or IPv6 address, or path of unix domain socket if it
+ * contains '/'. Port is not used for unix domain socket
+ *
+ * \return non-blocking socket, which listens the address, or -1 in case of
+ * error
+ */
+static int open_listener(const char *address, int port) noexcept;
+
+static bool is_unix_address(const char *address) noexcept;
+
+/**\return true if nobody listens the unix domain socket, so it was left by
+ * previous run and can be removed
+ */
+static bool is_stale_socket(const sockaddr_un &addr) noexcept;
+
+/**\brief accept connection on metrics listener and write report to it
+ */
+static void send_metrics(int metrics_sock) noexcept;
 
-static std::string
-process(const char *data, int default_flags_count, const char *default_flags[]);
 
 int main(int argc, char *argv[]) {
-  signal(SIGINT, signal_handler);
-  signal(SIGTERM, signal_handler);
+  // signals are handled by signalfd, workers inherit the mask
+  sigset_t sigmask;
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGINT);
+  sigaddset(&sigmask, SIGTERM);
+  sigaddset(&sigmask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &sigmask, NULL);
 
 #ifdef LOGGER_ADD_SYSLOG_SINK
   const char *program_name = strrchr(argv[0], '/');
@@ -54,8 +75,101 @@ int main(int argc, char *argv[]) {
                        "print more logs to stderr",
                        false);
   ARG_PARSER_ADD_INTD(parser, "port", 'p', "port for listener", 53827);
+  ARG_PARSER_ADD_STR(parser,
+                     "address",
+                     'a',
+                     "address for listener: IPv4 (127.0.0.1 by default), IPv6 "
+                     "or path of unix domain socket",
+                     false);
+  ARG_PARSER_ADD_INTD(parser,
+                      "metrics-port",
+                      0,
+                      "port for text report with metrics, 0 means no metrics",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "max-message-size",
+                      0,
+                      "max size of request in Mb, 0 means no limit",
+                      64);
+  ARG_PARSER_ADD_INTD(parser,
+                      "workers",
+                      0,
+                      "count of worker processes, 0 means count of cpu cores",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "threads",
+                      0,
+                      "count of tokenization threads in every worker, 0 means "
+                      "count of cpu cores",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "max-parses",
+                      0,
+                      "max count of concurrent parses in all workers, 0 means "
+                      "count of cpu cores",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "cache-memory",
+                      0,
+                      "memory budget of translation unit cache of every worker "
+                      "in Mb, 0 means no limit",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "response-cache",
+                      0,
+                      "count of latest responses, kept by every worker for "
+                      "unchanged buffers, 0 disables the cache",
+                      64);
+  ARG_PARSER_ADD_INTD(parser,
+                      "idle-reparse",
+                      0,
+                      "ms without requests, after which buffer is reparsed in "
+                      "background if its included files were changed, 0 "
+                      "disables background reparse",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "time-budget",
+                      0,
+                      "ms for tokenization of one request, buffer exceeded the "
+                      "budget is not parsed for some time, 0 means no limit",
+                      0);
+  ARG_PARSER_ADD_INTD(parser,
+                      "memory-budget",
+                      0,
+                      "memory budget of one translation unit in Mb, buffer "
+                      "exceeded the budget is not parsed for some time, 0 "
+                      "means no limit",
+                      0);
   ARG_PARSER_ADD_STR(parser, "root", 0, "set root direcotry", false);
   ARG_PARSER_ADD_STR(parser, "flag", 0, "default compilation flags", false);
+  ARG_PARSER_ADD_STR(parser,
+                     "compile-commands",
+                     0,
+                     "directory with compile_commands.json, flags from it are "
+                     "used before flags from client",
+                     false);
+  ARG_PARSER_ADD_STR(parser,
+                     "cache-dir",
+                     0,
+                     "directory for tokens of buffers, which are kept between "
+                     "restarts of the server",
+                     false);
+  ARG_PARSER_ADD_BOOLD(parser,
+                       "trust-clients",
+                       0,
+                       "don't validate requests by json schema",
+                       false);
+  ARG_PARSER_ADD_BOOLD(parser,
+                       "incremental-annotation",
+                       0,
+                       "annotate only changed lines of cached buffers",
+                       false);
+  ARG_PARSER_ADD_STR(parser,
+                     "parse-mode",
+                     0,
+                     "full (default) or preamble, last one uses precompiled "
+                     "preamble for faster reparsing of cached buffers",
+                     false);
 
 
   char *       err           = nullptr;
@@ -63,18 +177,34 @@ int main(int argc, char *argv[]) {
   bool         need_help     = false;
   bool         need_version  = false;
   bool         need_verbose  = false;
+  bool         trust_clients = false;
+  bool         incremental   = false;
   int          port          = 0;
+  int          worker_count  = 0;
+  int          thread_count  = 0;
+  int          max_parses    = 0;
+  int          max_msg_size  = 0;
+  int          cache_memory  = 0;
+  int          responses     = 0;
+  int          idle_reparse  = 0;
+  int          time_budget   = 0;
+  int          mem_budget    = 0;
   const char * root          = NULL;
+  const char * compile_cmds  = NULL;
+  const char * cache_dir     = NULL;
   int          flag_count    = 0;
   const char **default_flags = NULL;
 
-  int         sock = -1;
-  sockaddr_in addr;
-  int         in_sock = -1;
-  sockaddr_in in_addr;
-  socklen_t   sock_len   = 0;
-  int         reuse_addr = 1;
-  timeval     rcv_timeout;
+  const char *   parse_mode_str = NULL;
+  hl::parse_mode parse_mode     = hl::parse_mode::full;
+
+  const char *       address      = ADDRESS;
+  int                sock         = -1;
+  int                metrics_port = 0;
+  int                metrics_sock = -1;
+  int                signal_fd    = -1;
+  bool               done         = false;
+  hl::worker_options options;
 
   std::list<pid_t> children;
 
@@ -99,7 +229,75 @@ int main(int argc, char *argv[]) {
   }
 
   ARG_PARSER_GET_INT(parser, "port", port);
-  LOG_INFO("uses port: %d", port);
+  ARG_PARSER_GET_STR(parser, "address", address);
+  if (is_unix_address(address)) {
+    LOG_INFO("uses unix domain socket: %s", address);
+  } else {
+    LOG_INFO("uses address: %s, port: %d", address, port);
+  }
+
+  ARG_PARSER_GET_INT(parser, "metrics-port", metrics_port);
+
+  ARG_PARSER_GET_BOOL(parser, "trust-clients", trust_clients);
+  if (trust_clients) {
+    LOG_INFO("validation of requests is off");
+  }
+
+  ARG_PARSER_GET_BOOL(parser, "incremental-annotation", incremental);
+  if (incremental) {
+    LOG_INFO("uses incremental annotation");
+  }
+
+  ARG_PARSER_GET_INT(parser, "max-message-size", max_msg_size);
+  max_msg_size = max_msg_size > 0 ? max_msg_size : 0;
+  LOG_INFO("uses max message size: %dMb", max_msg_size);
+
+  ARG_PARSER_GET_INT(parser, "cache-memory", cache_memory);
+  cache_memory = cache_memory > 0 ? cache_memory : 0;
+  LOG_INFO("uses cache memory budget: %dMb", cache_memory);
+
+  ARG_PARSER_GET_INT(parser, "response-cache", responses);
+  responses = responses > 0 ? responses : 0;
+  LOG_INFO("uses response cache size: %d", responses);
+
+  ARG_PARSER_GET_INT(parser, "idle-reparse", idle_reparse);
+  idle_reparse = idle_reparse > 0 ? idle_reparse : 0;
+  if (idle_reparse > 0) {
+    LOG_INFO("uses background reparse after: %dms", idle_reparse);
+  }
+
+  ARG_PARSER_GET_INT(parser, "time-budget", time_budget);
+  time_budget = time_budget > 0 ? time_budget : 0;
+  if (time_budget > 0) {
+    LOG_INFO("uses time budget of request: %dms", time_budget);
+  }
+
+  ARG_PARSER_GET_INT(parser, "memory-budget", mem_budget);
+  mem_budget = mem_budget > 0 ? mem_budget : 0;
+  if (mem_budget > 0) {
+    LOG_INFO("uses memory budget of translation unit: %dMb", mem_budget);
+  }
+
+  ARG_PARSER_GET_INT(parser, "workers", worker_count);
+  if (worker_count <= 0) {
+    worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = worker_count > 0 ? worker_count : 1;
+  }
+  LOG_INFO("uses workers: %d", worker_count);
+
+  ARG_PARSER_GET_INT(parser, "threads", thread_count);
+  if (thread_count <= 0) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = thread_count > 0 ? thread_count : 1;
+  }
+  LOG_INFO("uses threads per worker: %d", thread_count);
+
+  ARG_PARSER_GET_INT(parser, "max-parses", max_parses);
+  if (max_parses <= 0) {
+    max_parses = sysconf(_SC_NPROCESSORS_ONLN);
+    max_parses = max_parses > 0 ? max_parses : 1;
+  }
+  LOG_INFO("uses max concurrent parses: %d", max_parses);
 
   if (ARG_PARSER_GET_STR(parser, "root", root) == 1) {
     LOG_INFO("change root dir to: %s", root);
@@ -108,6 +306,28 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (ARG_PARSER_GET_STR(parser, "parse-mode", parse_mode_str) == 1) {
+    bool ok    = false;
+    parse_mode = hl::parse_mode_from_string(parse_mode_str, ok);
+    if (ok == false) {
+      LOG_ERROR("invalid parse mode: %s", parse_mode_str);
+      goto Failure;
+    }
+    LOG_INFO("uses parse mode: %s", parse_mode_str);
+  }
+
+  if (ARG_PARSER_GET_STR(parser, "compile-commands", compile_cmds) == 1) {
+    LOG_INFO("uses compilation database from: %s", compile_cmds);
+  }
+
+  if (ARG_PARSER_GET_STR(parser, "cache-dir", cache_dir) == 1) {
+    if (mkdir(cache_dir, 0755) != 0 && errno != EEXIST) {
+      LOG_ERROR("can't create cache directory: %s", strerror(errno));
+      goto Failure;
+    }
+    LOG_INFO("uses cache directory: %s", cache_dir);
+  }
+
   flag_count = arg_parser_count(parser, "flag");
   if (flag_count > 0) {
     default_flags = new const char *[flag_count];
@@ -125,187 +345,130 @@ int main(int argc, char *argv[]) {
   }
 
 
-  // resolve address
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port   = htons(port);
-  result          = inet_aton(ADDRESS, &addr.sin_addr);
-  if (result != 0) {
-    LOG_ERROR("can't resolve address: %s:%d", ADDRESS, port);
-    goto Failure;
-  }
-
-  // open socket
-  sock = socket(AF_INET, SOCK_STREAM, 0);
+  sock = open_listener(address, port);
   if (sock < 0) {
-    LOG_ERROR("can't open listener: %s", strerror(errno));
     goto Failure;
   }
 
-  result = setsockopt(sock,
-                      SOL_SOCKET,
-                      SO_REUSEADDR,
-                      &reuse_addr,
-                      sizeof(reuse_addr));
-  if (result != 0) {
-    LOG_ERROR("can't set reuse option for listener");
+  if (hl::parse_limit::init(max_parses) == false) {
+    LOG_ERROR("can't create semaphores for limit of parses");
     goto Failure;
   }
+  LOG_INFO("uses semaphore set: %d", hl::parse_limit::id());
 
-  rcv_timeout.tv_sec  = 1;
-  rcv_timeout.tv_usec = 0;
-
-  result = setsockopt(sock,
-                      SOL_SOCKET,
-                      SO_RCVTIMEO,
-                      &rcv_timeout,
-                      sizeof(rcv_timeout));
-  if (result != 0) {
-    LOG_ERROR("can't set timeout for listener");
-    goto Failure;
-  }
+  if (metrics_port > 0) {
+    if (hl::metrics::init() == false) {
+      LOG_ERROR("can't allocate memory for metrics");
+      goto Failure;
+    }
 
-  // bind
-  result = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
-  if (result != 0) {
-    LOG_ERROR("can't bind listener: %s", strerror(errno));
-    goto Failure;
+    // report is requested rarely, so it is always available by tcp
+    metrics_sock = open_listener(ADDRESS, metrics_port);
+    if (metrics_sock < 0) {
+      goto Failure;
+    }
+    LOG_INFO("uses metrics port: %d", metrics_port);
   }
 
-  // listen
-  result = listen(sock, BACKLOG);
-  if (result != 0) {
-    LOG_ERROR("can't listened: %s", strerror(errno));
+  options.listener            = sock;
+  options.max_message_size    = static_cast<size_t>(max_msg_size) * 1024 * 1024;
+  options.thread_count        = thread_count;
+  options.validate_requests   = trust_clients == false;
+  options.mode                = parse_mode;
+  options.cache_memory        = static_cast<size_t>(cache_memory) * 1024 * 1024;
+  options.compile_commands    = compile_cmds;
+  options.cache_dir           = cache_dir;
+  options.response_cache_size = responses;
+  options.idle_reparse        = idle_reparse;
+  options.incremental         = incremental;
+  options.time_budget         = time_budget;
+  options.memory_budget       = static_cast<size_t>(mem_budget) * 1024 * 1024;
+  options.default_flags_count = flag_count;
+  options.default_flags       = default_flags;
+
+  signal_fd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+  if (signal_fd < 0) {
+    LOG_ERROR("can't create signalfd: %s", strerror(errno));
     goto Failure;
   }
 
   while (done == false) {
-    // accept new connection
-    sock_len = sizeof(in_addr);
-    in_sock  = accept(sock, (struct sockaddr *)&in_addr, &sock_len);
-    if (in_sock < 0 && errno == EAGAIN) {
-      continue;
-    } else if (in_sock < 0) {
-      LOG_ERROR("can't accept incomming socket: %s", strerror(errno));
-      continue;
-    }
-
-    LOG_INFO("accepted connection from port: %d", ntohs(in_addr.sin_port));
-
-    pid_t pid = fork();
-    if (pid == -1) {
-      close(in_sock);
-      LOG_ERROR("error during fork: %s", strerror(errno));
-      continue;
-    } else if (pid > 0) {
-      LOG_INFO("start child process: %d", pid);
-      children.emplace_back(pid);
-      continue;
-    }
-
-    // child
-    rcv_timeout.tv_sec  = 1;
-    rcv_timeout.tv_usec = 0;
-
-    result = setsockopt(in_sock,
-                        SOL_SOCKET,
-                        SO_RCVTIMEO,
-                        &rcv_timeout,
-                        sizeof(rcv_timeout));
-    if (result != 0) {
-      LOG_ERROR("can't set timeout for input socket");
-    }
-
-
-    int      count  = 0;
-    unsigned offset = 0;
-    char     buf[BUF_SIZE];
-    while (done == false) {
-      if (offset == sizeof(buf) - 1) {
-        LOG_WARNING(
-            "ignore %.1fKb of data, looks like you send very large files",
-            offset / 1024.);
-        offset = 0;
-      }
-
-      count = read(in_sock, buf + offset, sizeof(buf) - offset - 1);
-      if (count < 0 && errno == EAGAIN) {
-        continue;
-      } else if (count < 0 && errno != EAGAIN) {
-        LOG_ERROR("read error: %s", strerror(errno));
-        break;
-      } else if (count == 0) {
-        LOG_WARNING("eof from connection with port: %d",
-                    ntohs(in_addr.sin_port));
+    // (re)start workers
+    while (children.size() < static_cast<size_t>(worker_count)) {
+      pid_t pid = fork();
+      if (pid == -1) {
+        LOG_ERROR("error during fork: %s", strerror(errno));
         break;
-      }
-
-      LOG_DEBUG("readen: %.1fKb", count / 1024.);
-
-      offset += count;
-      buf[offset] = '\0';
-
-      if (buf[offset - 1] != DELIMITER) { // need more info
-        LOG_DEBUG("readen not enough data");
-
-        char *found = strrchr(buf, DELIMITER);
-        if (found) {
-          LOG_DEBUG("ignore old data: %.1fKb",
-                    std::distance(buf, found) / 1024.);
-          strcpy(buf, found);
-          offset = strlen(buf);
-        }
-
+      } else if (pid > 0) {
+        LOG_INFO("start worker process: %d", pid);
+        children.emplace_back(pid);
         continue;
       }
 
-
-      // get latest data
-      buf[offset - 1] = '\0'; // need for ignore latest delimiter
-      char *start     = strrchr(buf, DELIMITER);
-      start           = start ? start : buf;
-
-      LOG_DEBUG_IF(buf != start,
-                   "ignore old data: %.1fKb",
-                   std::distance(buf, start) / 1024.);
-
-
-      // process
-      std::string response = process(start, flag_count, default_flags);
-      count                = write(in_sock, response.c_str(), response.size());
-      if (count < 0) {
-        LOG_ERROR("failure during writting response: %s", strerror(errno));
-      } else {
-        LOG_DEBUG("written: %.1fKb", count / 1024.);
+      // child
+      close(signal_fd);
+      if (metrics_sock >= 0) {
+        close(metrics_sock);
       }
+      result = hl::run_worker(options);
+      close(sock);
 
-      char delim = DELIMITER;
-      count      = write(in_sock, &delim, 1);
-      if (count < 0) {
-        LOG_ERROR("failure during writing delimiter: %s", strerror(errno));
+      // just for convention
+      if (default_flags) {
+        delete[] default_flags;
       }
+      arg_parser_dispose(parser);
+      return result;
+    }
 
 
-      // clear buf
-      offset = 0;
+    // wait for signals, if some worker was not started, then try again later.
+    // Negative descriptor of metrics listener is ignored by poll
+    pollfd polls[2] = {{signal_fd, POLLIN, 0}, {metrics_sock, POLLIN, 0}};
+
+    result = poll(polls,
+                  2,
+                  children.size() < static_cast<size_t>(worker_count)
+                      ? FORK_RETRY_TIMEOUT
+                      : -1);
+    if (result <= 0) {
+      continue;
     }
 
-    // close input sock
-    LOG_INFO("close connection from port: %d", ntohs(in_addr.sin_port));
-    close(in_sock);
+    if (polls[1].revents & POLLIN) {
+      send_metrics(metrics_sock);
+    }
+    if ((polls[0].revents & POLLIN) == 0) {
+      continue;
+    }
+
+    signalfd_siginfo info;
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) {
+      LOG_ERROR("can't read signal info: %s", strerror(errno));
+      continue;
+    }
 
-    // just for convention
-    if (default_flags) {
-      delete[] default_flags;
+    switch (info.ssi_signo) {
+    case SIGCHLD: {
+      int   status = 0;
+      pid_t pid    = 0;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        children.remove(pid);
+        LOG_WARNING("worker %d finished unexpectedly with status: %d",
+                    pid,
+                    status);
+      }
+    } break;
+    default:
+      done = true;
+      break;
     }
-    arg_parser_dispose(parser);
-    return EXIT_SUCCESS;
   }
 
 
-  // finish
-  signal(SIGINT, SIG_DFL);
-  signal(SIGTERM, SIG_DFL);
+  // finish, next signal will terminate the process immediately
+  sigprocmask(SIG_UNBLOCK, &sigmask, NULL);
+  close(signal_fd);
 
   LOG_DEBUG("try close all children");
   for (pid_t child : children) {
@@ -323,11 +486,19 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  hl::parse_limit::finish();
+
   if (default_flags) {
     delete[] default_flags;
   }
 
   close(sock);
+  if (is_unix_address(address)) {
+    unlink(address);
+  }
+  if (metrics_sock >= 0) {
+    close(metrics_sock);
+  }
   arg_parser_dispose(parser);
 
   LOG_INFO("finish");
@@ -335,9 +506,16 @@ int main(int argc, char *argv[]) {
   return EXIT_SUCCESS;
 
 Failure:
+  if (signal_fd >= 0) {
+    close(signal_fd);
+  }
   if (sock >= 0) {
     close(sock);
   }
+  if (metrics_sock >= 0) {
+    close(metrics_sock);
+  }
+  hl::parse_limit::finish();
   if (err) {
     free(err);
   }
@@ -372,175 +550,135 @@ NeedHelp:
 }
 
 
-static void signal_handler(int) {
-  done = true;
-}
-
-static std::list<std::string> split(const std::string &str) {
-  std::list<std::string> retval;
+static int open_listener(const char *address, int port) noexcept {
+  int              sock       = -1;
+  int              result     = 0;
+  int              reuse_addr = 1;
+  sockaddr_storage addr;
+  socklen_t        addr_len = 0;
+  sockaddr_in *    addr_in  = reinterpret_cast<sockaddr_in *>(&addr);
+  sockaddr_in6 *   addr_in6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+  sockaddr_un *    addr_un  = reinterpret_cast<sockaddr_un *>(&addr);
+  mode_t           old_mask = 0;
 
-  const char *start = str.c_str();
-  do {
-    const char *found = strchr(start, DELIMITER);
-    if (found) {
-      retval.emplace_back(start, found++);
-    } else {
-      retval.emplace_back(start);
+  // resolve address
+  memset(&addr, 0, sizeof(addr));
+  if (is_unix_address(address)) {
+    if (strlen(address) >= sizeof(addr_un->sun_path)) {
+      LOG_ERROR("too long path of unix domain socket: %s", address);
+      return -1;
     }
 
-    start = found;
-  } while (start);
-
-  return retval;
-}
-
-static std::vector<const char *>
-to_argv(const std::list<std::string> &string_list) {
-  std::vector<const char *> retval;
-  retval.reserve(string_list.size());
-
-  for (const std::string &str : string_list) {
-    retval.emplace_back(str.c_str());
+    addr_un->sun_family = AF_UNIX;
+    strcpy(addr_un->sun_path, address);
+    addr_len = sizeof(sockaddr_un);
+
+    // socket file from previous run prevents binding, but socket of running
+    // server must not be removed
+    struct stat file_stat;
+    if (stat(address, &file_stat) == 0 && S_ISSOCK(file_stat.st_mode)) {
+      if (is_stale_socket(*addr_un) == false) {
+        LOG_ERROR("unix domain socket is used by other server: %s", address);
+        return -1;
+      }
+      unlink(address);
+    }
+  } else if (inet_pton(AF_INET, address, &addr_in->sin_addr) == 1) {
+    addr_in->sin_family = AF_INET;
+    addr_in->sin_port   = htons(port);
+    addr_len            = sizeof(sockaddr_in);
+  } else if (inet_pton(AF_INET6, address, &addr_in6->sin6_addr) == 1) {
+    addr_in6->sin6_family = AF_INET6;
+    addr_in6->sin6_port   = htons(port);
+    addr_len              = sizeof(sockaddr_in6);
+  } else {
+    LOG_ERROR("can't resolve address: %s:%d", address, port);
+    return -1;
   }
 
-  return retval;
-}
-
-#define VERSION_TAG         "version"
-#define ID_TAG              "id"
-#define BUF_TYPE_TAG        "buf_type"
-#define BUF_NAME_TAG        "buf_name"
-#define BUF_BODY_TAG        "buf_body"
-#define ADDITIONAL_INFO_TAG "additional_info"
-#define RETURN_CODE_TAG     "return_code"
-#define ERROR_MESSAGE_TAG   "error_message"
-#define TOKENS_TAG          "tokens"
-
-static std::string process(const char *data,
-                           int         default_flags_count,
-                           const char *default_flags[]) {
-  using nlohmann::json;
-  using nlohmann::json_schema::json_validator;
-
-  int         message_number = -1;
-  std::string version;
-  std::string id;
-  std::string buf_type;
-  std::string buf_name;
-  std::string buf_body;
-  std::string additional_info;
-
-  json jresponse;
-
-  char        filename[] = ".hl-server-tmp-file-XXXXXX";
-  int         fd         = -1;
-  int         written    = 0;
-  std::string err;
-
-  std::list<std::string>    args;
-  std::vector<const char *> argv;
-  hl::token_list            tokens;
-
-
-  try {
-    static json schema = json::parse(request_schema_v11);
-
-
-    json_validator validator;
-    validator.set_root_schema(schema);
-
-    json jdata = json::parse(data);
-    validator.validate(jdata);
-
-    message_number  = jdata[0];
-    version         = jdata[1][VERSION_TAG];
-    id              = jdata[1][ID_TAG];
-    buf_type        = jdata[1][BUF_TYPE_TAG];
-    buf_name        = jdata[1][BUF_NAME_TAG];
-    buf_body        = jdata[1][BUF_BODY_TAG];
-    additional_info = jdata[1][ADDITIONAL_INFO_TAG];
-  } catch (std::exception &e) {
-    LOG_ERROR("json handling error: %s", e.what());
-    return "";
+  // open socket
+  sock = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (sock < 0) {
+    LOG_ERROR("can't open listener: %s", strerror(errno));
+    return -1;
   }
 
-  jresponse[0]               = message_number;
-  jresponse[1][VERSION_TAG]  = version;
-  jresponse[1][ID_TAG]       = id;
-  jresponse[1][BUF_TYPE_TAG] = buf_type;
-  jresponse[1][BUF_NAME_TAG] = buf_name;
-  jresponse[1][TOKENS_TAG]   = json::object(); // placeholder
-
-  if (buf_type != "cpp" && buf_type != "c") {
-    LOG_WARNING("not supported buffer type: %s", buf_type.c_str());
-
-    jresponse[1][RETURN_CODE_TAG]   = 1;
-    jresponse[1][ERROR_MESSAGE_TAG] = "unsupported buffer type: " + buf_type;
-    goto Finish;
+  result = setsockopt(sock,
+                      SOL_SOCKET,
+                      SO_REUSEADDR,
+                      &reuse_addr,
+                      sizeof(reuse_addr));
+  if (result != 0) {
+    LOG_ERROR("can't set reuse option for listener");
+    close(sock);
+    return -1;
   }
 
-
-  // create tmp file
-  fd = mkstemp(filename);
-  if (fd < 0) {
-    LOG_ERROR("can't open temporary file: %s", strerror(errno));
-
-    jresponse[1][RETURN_CODE_TAG]   = 2;
-    jresponse[1][ERROR_MESSAGE_TAG] = "can't open temporary file for buffer";
-    goto Finish;
+  // all workers wait for connections on the listener, so accept must not
+  // block workers, which lost connection
+  result = fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  if (result != 0) {
+    LOG_ERROR("can't set non-blocking mode for listener");
+    close(sock);
+    return -1;
   }
 
-  written = write(fd, buf_body.c_str(), buf_body.size());
-  if (written < 0) {
-    LOG_ERROR("can't write buffer to temporary file: %s", strerror(errno));
-
-    jresponse[1][RETURN_CODE_TAG]   = 3;
-    jresponse[1][ERROR_MESSAGE_TAG] = "can't write buffer to temporary file";
-    goto Finish;
+  // bind, other users of host must not connect to unix domain socket, so it
+  // is created with owner permissions only, without window for other users
+  old_mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+  result   = bind(sock, (struct sockaddr *)&addr, addr_len);
+  umask(old_mask);
+  if (result != 0) {
+    LOG_ERROR("can't bind listener: %s", strerror(errno));
+    close(sock);
+    return -1;
   }
 
-
-  // tokenization
-  args = split(additional_info);
-  argv = to_argv(args);
-  for (int i = 0; i < default_flags_count; ++i) {
-    argv.push_back(default_flags[i]);
+  // listen
+  result = listen(sock, BACKLOG);
+  if (result != 0) {
+    LOG_ERROR("can't listened: %s", strerror(errno));
+    close(sock);
+    return -1;
   }
 
-  tokens = hl::clang_tokenize(filename, argv.size(), argv.data(), err);
-  if (err.empty() == false) {
-    LOG_ERROR("error from tokenizer: %s", err.c_str());
+  return sock;
+}
 
-    jresponse[1][RETURN_CODE_TAG]   = 4;
-    jresponse[1][ERROR_MESSAGE_TAG] = "error from tokenizer: " + err;
-    goto Finish;
-  }
+static bool is_unix_address(const char *address) noexcept {
+  return strchr(address, '/') != nullptr;
+}
 
-  for (const hl::token &token : tokens) {
-    jresponse[1][TOKENS_TAG][token.group].emplace_back(token.pos);
+static bool is_stale_socket(const sockaddr_un &addr) noexcept {
+  int  sock  = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  bool stale = false;
+  if (sock < 0) {
+    LOG_ERROR("can't open socket for checking: %s", strerror(errno));
+    return false;
   }
 
+  // running server accepts connection, or has full backlog (EAGAIN)
+  stale = connect(sock, (const sockaddr *)&addr, sizeof(addr)) != 0 &&
+          (errno == ECONNREFUSED || errno == ENOENT);
+  close(sock);
+  return stale;
+}
 
-  jresponse[1][RETURN_CODE_TAG]   = 0;
-  jresponse[1][ERROR_MESSAGE_TAG] = "";
-
-
-Finish:
-  if (fd > 0) {
-    close(fd);
-    remove(filename);
+static void send_metrics(int metrics_sock) noexcept {
+  int sock = accept4(metrics_sock, NULL, NULL, SOCK_CLOEXEC);
+  if (sock < 0) {
+    return;
   }
 
-#ifndef DNDEBUG
   try {
-    static json    response_schema = json::parse(response_schema_v11);
-    json_validator response_validator;
-    response_validator.set_root_schema(response_schema);
-    response_validator.validate(jresponse);
+    // report is small, so it fits to buffer of socket
+    std::string report = hl::metrics::report();
+    if (write(sock, report.data(), report.size()) < 0) {
+      LOG_ERROR("can't write metrics: %s", strerror(errno));
+    }
   } catch (std::exception &e) {
-    LOG_ERROR("fail validating json response: %s", e.what());
+    LOG_ERROR("can't make metrics report: %s", e.what());
   }
-#endif
 
-  return jresponse.dump();
+  close(sock);
 }
@@ -0,0 +1,231 @@
+#include "metrics.hpp"
+#include <atomic>
+#include <cstdio>
+#include <sys/mman.h>
+
+
+// bucket i contains durations in [2^(i-1), 2^i) microseconds
+#define BUCKET_COUNT 40
+
+#define STAGE_COUNT   static_cast<size_t>(hl::metrics::stage::count)
+#define COUNTER_COUNT static_cast<size_t>(hl::metrics::counter::count)
+
+
+// values are changed by several processes, so must be lock free
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "atomics are not lock free");
+
+using atomic_counter = std::atomic<unsigned long long>;
+
+struct histogram {
+  atomic_counter buckets[BUCKET_COUNT];
+  atomic_counter count;
+  atomic_counter sum; // microseconds
+  atomic_counter max; // microseconds
+};
+
+struct storage {
+  histogram      stages[STAGE_COUNT];
+  atomic_counter counters[COUNTER_COUNT];
+};
+
+static storage *shared_storage = nullptr;
+
+
+static const char *stage_names[STAGE_COUNT] = {
+    "request_parse",
+    "validation",
+    "parse",
+    "reparse",
+    "annotate",
+    "classify",
+    "serialize",
+    "write",
+    "request",
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "requests",
+    "cancelled",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions",
+    "disk_cache_hits",
+    "response_cache_hits",
+    "over_budget",
+};
+
+
+static size_t get_bucket(unsigned long long microseconds) noexcept;
+
+/**\return upper bound of duration (in microseconds) for the part of values
+ */
+static unsigned long long get_percentile(const histogram &hist,
+                                         double           part) noexcept;
+
+
+namespace hl {
+namespace metrics {
+bool init() noexcept {
+  if (shared_storage != nullptr) {
+    return true;
+  }
+
+  // anonymous shared memory is inherited by forked workers
+  void *memory = mmap(nullptr,
+                      sizeof(storage),
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS,
+                      -1,
+                      0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+
+  // mmap returns zeroed memory, so all counters are already initialized
+  shared_storage = static_cast<storage *>(memory);
+  return true;
+}
+
+void record(stage which, duration time) noexcept {
+  if (shared_storage == nullptr) {
+    return;
+  }
+
+  unsigned long long microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+
+  histogram &hist = shared_storage->stages[static_cast<size_t>(which)];
+  hist.buckets[get_bucket(microseconds)].fetch_add(1,
+                                                   std::memory_order_relaxed);
+  hist.count.fetch_add(1, std::memory_order_relaxed);
+  hist.sum.fetch_add(microseconds, std::memory_order_relaxed);
+
+  unsigned long long max = hist.max.load(std::memory_order_relaxed);
+  while (max < microseconds &&
+         hist.max.compare_exchange_weak(max,
+                                        microseconds,
+                                        std::memory_order_relaxed) == false) {
+  }
+}
+
+void increment(counter which) noexcept {
+  if (shared_storage == nullptr) {
+    return;
+  }
+
+  shared_storage->counters[static_cast<size_t>(which)].fetch_add(
+      1,
+      std::memory_order_relaxed);
+}
+
+std::string report() {
+  if (shared_storage == nullptr) {
+    return "metrics are not collected\n";
+  }
+
+  std::string retval;
+  char        line[256];
+
+  snprintf(line,
+           sizeof(line),
+           "%-16s %10s %10s %10s %10s %10s\n",
+           "stage(us)",
+           "count",
+           "mean",
+           "p50",
+           "p99",
+           "max");
+  retval += line;
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    const histogram &  hist  = shared_storage->stages[i];
+    unsigned long long count = hist.count.load();
+    snprintf(line,
+             sizeof(line),
+             "%-16s %10llu %10llu %10llu %10llu %10llu\n",
+             stage_names[i],
+             count,
+             count != 0 ? hist.sum.load() / count : 0,
+             get_percentile(hist, 0.5),
+             get_percentile(hist, 0.99),
+             hist.max.load());
+    retval += line;
+  }
+
+  retval += '\n';
+  for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+    snprintf(line,
+             sizeof(line),
+             "%-16s %10llu\n",
+             counter_names[i],
+             shared_storage->counters[i].load());
+    retval += line;
+  }
+
+  unsigned long long hits =
+      shared_storage->counters[static_cast<size_t>(counter::cache_hits)];
+  unsigned long long misses =
+      shared_storage->counters[static_cast<size_t>(counter::cache_misses)];
+  snprintf(line,
+           sizeof(line),
+           "%-16s %10.2f\n",
+           "cache_hit_rate",
+           hits + misses != 0 ? static_cast<double>(hits) / (hits + misses)
+                              : 0.);
+  retval += line;
+
+  return retval;
+}
+
+
+scoped_timer::scoped_timer(stage which) noexcept
+    : stage_{which}
+    , start_{std::chrono::steady_clock::now()}
+    , stopped_{false} {
+}
+
+scoped_timer::~scoped_timer() noexcept {
+  this->stop();
+}
+
+void scoped_timer::stop() noexcept {
+  if (stopped_) {
+    return;
+  }
+
+  stopped_ = true;
+  record(stage_, std::chrono::steady_clock::now() - start_);
+}
+} // namespace metrics
+} // namespace hl
+
+
+static size_t get_bucket(unsigned long long microseconds) noexcept {
+  size_t bucket = 0;
+  while (microseconds != 0 && bucket < BUCKET_COUNT - 1) {
+    microseconds >>= 1;
+    ++bucket;
+  }
+
+  return bucket;
+}
+
+static unsigned long long get_percentile(const histogram &hist,
+                                         double           part) noexcept {
+  unsigned long long count = hist.count.load();
+  if (count == 0) {
+    return 0;
+  }
+
+  unsigned long long needed = static_cast<unsigned long long>(count * part);
+  unsigned long long summ   = 0;
+  for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+    summ += hist.buckets[i].load();
+    if (summ > needed) {
+      unsigned long long max = hist.max.load();
+      unsigned long long top = i == 0 ? 1 : 1ull << i;
+      return top < max ? top : max;
+    }
+  }
+
+  return hist.max.load();
+}
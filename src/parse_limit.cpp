@@ -0,0 +1,108 @@
+#include "parse_limit.hpp"
+#include <cerrno>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+
+
+// indexes of semaphores in the set
+#define ALL_SLOTS        0 // slots for all parses
+#define BACKGROUND_SLOTS 1 // additional slots, required for background parses
+
+// argument of semctl, must be defined by caller
+union semaphore_arg {
+  int              val;
+  struct semid_ds *buf;
+  unsigned short * array;
+};
+
+// system V semaphores are changed with SEM_UNDO, so kernel returns slots of
+// worker, which crashed or was killed during parsing
+static int semaphore_set = -1;
+
+
+/**\brief take (if delta is negative) or return slots, both semaphores are
+ * changed atomically. Waits for free slots, even if the wait is interrupted
+ * by signal
+ *
+ * \return false in case of error
+ */
+static bool change_slots(bool background, short delta) noexcept;
+
+
+namespace hl {
+namespace parse_limit {
+bool init(unsigned int count) noexcept {
+  if (semaphore_set >= 0) {
+    return true;
+  }
+
+  // private set is inherited by forked workers
+  int set = semget(IPC_PRIVATE, 2, IPC_CREAT | 0600);
+  if (set < 0) {
+    return false;
+  }
+
+  semaphore_arg all;
+  semaphore_arg background;
+  all.val        = count;
+  background.val = count > 1 ? count / 2 : 1;
+  if (semctl(set, ALL_SLOTS, SETVAL, all) != 0 ||
+      semctl(set, BACKGROUND_SLOTS, SETVAL, background) != 0) {
+    semctl(set, 0, IPC_RMID);
+    return false;
+  }
+
+  semaphore_set = set;
+  return true;
+}
+
+void finish() noexcept {
+  if (semaphore_set < 0) {
+    return;
+  }
+
+  semctl(semaphore_set, 0, IPC_RMID);
+  semaphore_set = -1;
+}
+
+int id() noexcept {
+  return semaphore_set;
+}
+
+scoped_slot::scoped_slot(bool background) noexcept
+    : background_{background}
+    , acquired_{false} {
+  if (semaphore_set < 0) {
+    return;
+  }
+
+  acquired_ = change_slots(background_, -1);
+}
+
+scoped_slot::~scoped_slot() noexcept {
+  if (acquired_ == false) {
+    return;
+  }
+
+  change_slots(background_, 1);
+}
+} // namespace parse_limit
+} // namespace hl
+
+
+static bool change_slots(bool background, short delta) noexcept {
+  sembuf ops[2];
+  ops[0].sem_num = ALL_SLOTS;
+  ops[0].sem_op  = delta;
+  ops[0].sem_flg = SEM_UNDO;
+  ops[1].sem_num = BACKGROUND_SLOTS;
+  ops[1].sem_op  = delta;
+  ops[1].sem_flg = SEM_UNDO;
+
+  while (semop(semaphore_set, ops, background ? 2 : 1) != 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
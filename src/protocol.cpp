@@ -0,0 +1,782 @@
+#include "protocol.hpp"
+#include "c_logs/log.h"
+#include "metrics.hpp"
+#include "rr_schemes.h"
+#include <cstring>
+#include <map>
+#include <nlohmann/json-schema.hpp>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+
+#define VERSION_TAG         "version"
+#define ID_TAG              "id"
+#define BUF_TYPE_TAG        "buf_type"
+#define BUF_NAME_TAG        "buf_name"
+#define BUF_BODY_TAG        "buf_body"
+#define ADDITIONAL_INFO_TAG "additional_info"
+#define RANGE_TAG           "range"
+#define BEGIN_LINE_TAG      "begin_line"
+#define END_LINE_TAG        "end_line"
+#define EDITS_TAG           "edits"
+#define BEGIN_COLUMN_TAG    "begin_column"
+#define END_COLUMN_TAG      "end_column"
+#define TEXT_TAG            "text"
+#define PRIORITY_TAG        "priority"
+#define LEXICAL_TAG         "lexical"
+#define RETURN_CODE_TAG     "return_code"
+#define ERROR_MESSAGE_TAG   "error_message"
+#define TOKENS_TAG          "tokens"
+#define DIFF_TAG            "diff"
+#define REMOVED_TOKENS_TAG  "removed_tokens"
+#define SHIFT_TAG           "shift"
+#define LINE_TAG            "line"
+#define ROWS_TAG            "rows"
+
+
+using nlohmann::json;
+using nlohmann::json_schema::json_validator;
+using validator_map = std::map<std::string, json_validator>;
+
+struct protocol_schemas {
+  const char *version;
+  const char *request_schema;
+  const char *response_schema;
+  bool        diff_mode;
+  bool        edits_mode;
+  bool        lexical_mode;
+};
+
+static const protocol_schemas supported_protocols[] = {
+    {"v1.1", request_schema_v11, response_schema_v11, false, false, false},
+    {"v1.2", request_schema_v12, response_schema_v12, false, false, true},
+    {"v1.3", request_schema_v13, response_schema_v13, true, false, true},
+    {"v1.4", request_schema_v14, response_schema_v14, true, true, true},
+};
+
+/**\return compiled validator for request (or response) of the version of
+ * protocol, or nullptr if the version is not supported
+ */
+static const json_validator *get_validator(const std::string &version,
+                                           bool is_request) noexcept;
+
+static const protocol_schemas *
+get_protocol(const std::string &version) noexcept;
+
+/**\return priority::visible if the string is not valid name of priority
+ */
+static hl::priority priority_from_string(const std::string &str) noexcept;
+
+/**\brief builds document of request by sax events, but moves body of buffer
+ * directly to request, so the largest string is not copied from document.
+ * Document gets empty string instead of the body, so it still can be
+ * validated
+ */
+class request_builder : public nlohmann::json_sax<json> {
+public:
+  request_builder(json &root, std::string &buf_body) noexcept;
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &str) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t                        position,
+                   const std::string &                last_token,
+                   const nlohmann::detail::exception &ex) override;
+
+  const std::string &error() const noexcept;
+
+private:
+  /**\brief add value to current container, or set it as root
+   *
+   * \return added value
+   */
+  template <typename Value>
+  json *add(Value &&value);
+
+  json &              root_;
+  std::string &       buf_body_;
+  std::vector<json *> stack_; // opened containers
+  std::string         key_;   // for next value of current object
+  bool                body_next_;
+  std::string         error_;
+};
+
+/**\brief fill request by data from document, body of buffer must be already
+ * moved to request by request_builder
+ *
+ * \throw exception if document is not valid request
+ */
+static bool read_request(json &jdata, hl::request &req, bool validate);
+
+static void append_int(std::string &out, long long value) noexcept;
+
+/**\brief tokens, stable sorted by groups. Groups are ordered by first token
+ * of the group, tokens of group_order[i] ends at group_ends[group_order[i]]
+ */
+struct grouped_tokens {
+  std::vector<size_t>            group_ends;
+  std::vector<hl::group_id>      group_order;
+  std::vector<const hl::token *> sorted;
+};
+
+static void group_tokens(const hl::token_list &tokens,
+                         grouped_tokens &      grouped) noexcept;
+
+/**\brief append tokens object with tokens grouped by token groups
+ */
+static void append_tokens(std::string &          out,
+                          const hl::token_list &tokens) noexcept;
+
+/**\brief append quoted and escaped string
+ */
+static void append_string(std::string &out, const std::string &str) noexcept;
+
+// msgpack writers, every value is written by smallest possible format
+static void append_msgpack_int(std::string &out, long long value) noexcept;
+static void append_msgpack_string(std::string &out,
+                                  const char * str,
+                                  size_t       size) noexcept;
+static void append_msgpack_string(std::string &out, const char *str) noexcept;
+static void append_msgpack_string(std::string &      out,
+                                  const std::string &str) noexcept;
+static void append_msgpack_array(std::string &out, size_t size) noexcept;
+static void append_msgpack_map(std::string &out, size_t size) noexcept;
+static void append_msgpack_tokens(std::string &         out,
+                                  const hl::token_list &tokens) noexcept;
+
+
+namespace hl {
+bool parse_request(const char *data, hl::request &req, bool validate) noexcept {
+  try {
+    hl::metrics::scoped_timer timer{hl::metrics::stage::request_parse};
+    json                      jdata;
+    request_builder           builder{jdata, req.buf_body};
+    if (json::sax_parse(data, &builder) == false) {
+      LOG_ERROR("json handling error: %s", builder.error().c_str());
+      return false;
+    }
+    timer.stop();
+
+    return read_request(jdata, req, validate);
+  } catch (std::exception &e) {
+    LOG_ERROR("json handling error: %s", e.what());
+    return false;
+  }
+}
+
+bool parse_msgpack_request(const char * data,
+                           size_t       size,
+                           hl::request &req,
+                           bool         validate) noexcept {
+  try {
+    hl::metrics::scoped_timer timer{hl::metrics::stage::request_parse};
+    json                      jdata;
+    request_builder           builder{jdata, req.buf_body};
+    if (json::sax_parse(data,
+                        data + size,
+                        &builder,
+                        nlohmann::detail::input_format_t::msgpack) == false) {
+      LOG_ERROR("msgpack handling error: %s", builder.error().c_str());
+      return false;
+    }
+    timer.stop();
+
+    return read_request(jdata, req, validate);
+  } catch (std::exception &e) {
+    LOG_ERROR("msgpack handling error: %s", e.what());
+    return false;
+  }
+}
+
+void serialize_response(const hl::response &resp, std::string &out) noexcept {
+  size_t begin = out.size();
+
+  out += "[";
+  append_int(out, resp.message_number);
+  out += ",{\"" VERSION_TAG "\":";
+  append_string(out, resp.version);
+  out += ",\"" ID_TAG "\":";
+  append_string(out, resp.id);
+  out += ",\"" BUF_TYPE_TAG "\":";
+  append_string(out, resp.buf_type);
+  out += ",\"" BUF_NAME_TAG "\":";
+  append_string(out, resp.buf_name);
+  out += ",\"" RETURN_CODE_TAG "\":";
+  append_int(out, resp.return_code);
+  out += ",\"" ERROR_MESSAGE_TAG "\":";
+  append_string(out, resp.error_message);
+  if (resp.diff_mode) {
+    out += ",\"" DIFF_TAG "\":";
+    out += resp.is_diff ? "true" : "false";
+    out += ",\"" REMOVED_TOKENS_TAG "\":";
+    append_tokens(out, resp.removed_tokens);
+  }
+  if (resp.diff_mode && resp.is_diff && resp.shift_rows != 0) {
+    out += ",\"" SHIFT_TAG "\":{\"" LINE_TAG "\":";
+    append_int(out, resp.shift_line);
+    out += ",\"" ROWS_TAG "\":";
+    append_int(out, resp.shift_rows);
+    out += "}";
+  }
+  if (resp.lexical_mode && resp.lexical) {
+    out += ",\"" LEXICAL_TAG "\":true";
+  }
+  out += ",\"" TOKENS_TAG "\":";
+  append_tokens(out, resp.tokens);
+  out += "}]";
+
+#ifndef NDEBUG
+  try {
+    const json_validator *validator = get_validator(resp.version, false);
+    if (validator) {
+      validator->validate(json::parse(out.begin() + begin, out.end()));
+    } else {
+      LOG_ERROR("fail validating json response: unknown version");
+    }
+  } catch (std::exception &e) {
+    LOG_ERROR("fail validating json response: %s", e.what());
+  }
+#else
+  (void)begin;
+#endif
+}
+
+void serialize_msgpack_response(const hl::response &resp,
+                                std::string &       out) noexcept {
+  size_t begin   = out.size();
+  bool   lexical = resp.lexical_mode && resp.lexical;
+  bool   shift   = resp.diff_mode && resp.is_diff && resp.shift_rows != 0;
+
+  append_msgpack_array(out, 2);
+  append_msgpack_int(out, resp.message_number);
+  append_msgpack_map(out,
+                     7 + (resp.diff_mode ? 2 : 0) + (shift ? 1 : 0) +
+                         (lexical ? 1 : 0));
+  append_msgpack_string(out, VERSION_TAG);
+  append_msgpack_string(out, resp.version);
+  append_msgpack_string(out, ID_TAG);
+  append_msgpack_string(out, resp.id);
+  append_msgpack_string(out, BUF_TYPE_TAG);
+  append_msgpack_string(out, resp.buf_type);
+  append_msgpack_string(out, BUF_NAME_TAG);
+  append_msgpack_string(out, resp.buf_name);
+  append_msgpack_string(out, RETURN_CODE_TAG);
+  append_msgpack_int(out, resp.return_code);
+  append_msgpack_string(out, ERROR_MESSAGE_TAG);
+  append_msgpack_string(out, resp.error_message);
+  if (resp.diff_mode) {
+    append_msgpack_string(out, DIFF_TAG);
+    out += resp.is_diff ? '\xc3' : '\xc2';
+    append_msgpack_string(out, REMOVED_TOKENS_TAG);
+    append_msgpack_tokens(out, resp.removed_tokens);
+  }
+  if (shift) {
+    append_msgpack_string(out, SHIFT_TAG);
+    append_msgpack_map(out, 2);
+    append_msgpack_string(out, LINE_TAG);
+    append_msgpack_int(out, resp.shift_line);
+    append_msgpack_string(out, ROWS_TAG);
+    append_msgpack_int(out, resp.shift_rows);
+  }
+  if (lexical) {
+    append_msgpack_string(out, LEXICAL_TAG);
+    out += '\xc3';
+  }
+  append_msgpack_string(out, TOKENS_TAG);
+  append_msgpack_tokens(out, resp.tokens);
+
+#ifndef NDEBUG
+  try {
+    const json_validator *validator = get_validator(resp.version, false);
+    if (validator) {
+      validator->validate(json::from_msgpack(out.begin() + begin, out.end()));
+    } else {
+      LOG_ERROR("fail validating msgpack response: unknown version");
+    }
+  } catch (std::exception &e) {
+    LOG_ERROR("fail validating msgpack response: %s", e.what());
+  }
+#else
+  (void)begin;
+#endif
+}
+} // namespace hl
+
+
+request_builder::request_builder(json &root, std::string &buf_body) noexcept
+    : root_{root}
+    , buf_body_{buf_body}
+    , body_next_{false} {
+  buf_body_.clear();
+}
+
+bool request_builder::null() {
+  this->add(nullptr);
+  return true;
+}
+
+bool request_builder::boolean(bool val) {
+  this->add(val);
+  return true;
+}
+
+bool request_builder::number_integer(number_integer_t val) {
+  this->add(val);
+  return true;
+}
+
+bool request_builder::number_unsigned(number_unsigned_t val) {
+  this->add(val);
+  return true;
+}
+
+bool request_builder::number_float(number_float_t val, const string_t &str) {
+  (void)str;
+  this->add(val);
+  return true;
+}
+
+bool request_builder::string(string_t &val) {
+  if (body_next_) {
+    // string was already unescaped by parser, so just take it
+    buf_body_ = std::move(val);
+    this->add(std::string{});
+  } else {
+    this->add(std::move(val));
+  }
+  return true;
+}
+
+bool request_builder::binary(binary_t &val) {
+  this->add(std::move(val));
+  return true;
+}
+
+bool request_builder::start_object(std::size_t elements) {
+  (void)elements;
+  stack_.emplace_back(this->add(json::value_t::object));
+  return true;
+}
+
+bool request_builder::key(string_t &val) {
+  // body is value of the key in object, which is second element of root
+  body_next_ = stack_.size() == 2 && stack_[0]->is_array() &&
+               stack_[0]->size() == 2 && val == BUF_BODY_TAG;
+  key_       = std::move(val);
+  return true;
+}
+
+bool request_builder::end_object() {
+  stack_.pop_back();
+  return true;
+}
+
+bool request_builder::start_array(std::size_t elements) {
+  (void)elements;
+  stack_.emplace_back(this->add(json::value_t::array));
+  return true;
+}
+
+bool request_builder::end_array() {
+  stack_.pop_back();
+  return true;
+}
+
+bool request_builder::parse_error(std::size_t                        position,
+                                  const std::string &                last_token,
+                                  const nlohmann::detail::exception &ex) {
+  (void)position;
+  (void)last_token;
+  error_ = ex.what();
+  return false;
+}
+
+const std::string &request_builder::error() const noexcept {
+  return error_;
+}
+
+template <typename Value>
+json *request_builder::add(Value &&value) {
+  body_next_ = false;
+
+  if (stack_.empty()) {
+    root_ = json(std::forward<Value>(value));
+    return &root_;
+  }
+
+  // containers are not changed while there are opened nested containers, so
+  // pointers in stack stay valid
+  json &parent = *stack_.back();
+  if (parent.is_array()) {
+    parent.emplace_back(std::forward<Value>(value));
+    return &parent.back();
+  }
+
+  json &slot = parent[key_];
+  slot       = json(std::forward<Value>(value));
+  return &slot;
+}
+
+static bool read_request(json &jdata, hl::request &req, bool validate) {
+  if (validate) {
+    const json_validator *validator = nullptr;
+    if (jdata.is_array() && jdata.size() > 1 && jdata[1].is_object() &&
+        jdata[1][VERSION_TAG].is_string()) {
+      validator = get_validator(jdata[1][VERSION_TAG], true);
+    }
+
+    if (validator == nullptr) {
+      LOG_ERROR("invalid request: unsupported version of protocol");
+      return false;
+    }
+
+    hl::metrics::scoped_timer timer{hl::metrics::stage::validation};
+    validator->validate(jdata);
+  }
+
+  const protocol_schemas *protocol = get_protocol(jdata[1][VERSION_TAG]);
+  req.diff_mode    = protocol != nullptr && protocol->diff_mode;
+  req.edits_mode   = protocol != nullptr && protocol->edits_mode;
+  req.lexical_mode = protocol != nullptr && protocol->lexical_mode;
+
+  req.message_number  = jdata[0];
+  req.version         = jdata[1][VERSION_TAG];
+  req.id              = jdata[1][ID_TAG];
+  req.buf_type        = jdata[1][BUF_TYPE_TAG];
+  req.buf_name        = jdata[1][BUF_NAME_TAG];
+  req.additional_info = jdata[1][ADDITIONAL_INFO_TAG];
+
+  req.incremental = false;
+  req.edits.clear();
+  auto edits = jdata[1].find(EDITS_TAG);
+  if (edits != jdata[1].end()) {
+    req.incremental = true;
+    req.edits.reserve(edits->size());
+    for (const json &jedit : *edits) {
+      req.edits.emplace_back(hl::text_edit{jedit.at(BEGIN_LINE_TAG),
+                                           jedit.at(BEGIN_COLUMN_TAG),
+                                           jedit.at(END_LINE_TAG),
+                                           jedit.at(END_COLUMN_TAG),
+                                           jedit.at(TEXT_TAG)});
+    }
+  } else {
+    // document contains placeholder instead of the body, it is checked
+    // because request without validation can have no body or invalid one
+    jdata[1].at(BUF_BODY_TAG).get_ref<const std::string &>();
+  }
+
+  req.begin_line = 0;
+  req.end_line   = 0;
+  auto range     = jdata[1].find(RANGE_TAG);
+  if (range != jdata[1].end()) {
+    req.begin_line = range->at(BEGIN_LINE_TAG);
+    req.end_line   = range->at(END_LINE_TAG);
+  }
+
+  req.priority  = hl::priority::visible;
+  auto priority = jdata[1].find(PRIORITY_TAG);
+  if (priority != jdata[1].end()) {
+    req.priority = priority_from_string(priority->get<std::string>());
+  }
+
+  req.lexical  = false;
+  auto lexical = jdata[1].find(LEXICAL_TAG);
+  if (lexical != jdata[1].end()) {
+    req.lexical = lexical->get<bool>();
+  }
+
+  return true;
+}
+
+static hl::priority priority_from_string(const std::string &str) noexcept {
+  if (str == "focused") {
+    return hl::priority::focused;
+  } else if (str == "background") {
+    return hl::priority::background;
+  }
+  return hl::priority::visible;
+}
+
+static void append_int(std::string &out, long long value) noexcept {
+  char  buf[24];
+  char *end = buf + sizeof(buf);
+  char *pos = end;
+
+  unsigned long long abs_value =
+      value < 0 ? 0ull - static_cast<unsigned long long>(value) : value;
+  do {
+    *--pos = '0' + abs_value % 10;
+    abs_value /= 10;
+  } while (abs_value != 0);
+
+  if (value < 0) {
+    *--pos = '-';
+  }
+
+  out.append(pos, end);
+}
+
+static void group_tokens(const hl::token_list &tokens,
+                         grouped_tokens &      grouped) noexcept {
+  std::vector<size_t> &      group_ends  = grouped.group_ends;
+  std::vector<hl::group_id> &group_order = grouped.group_order;
+
+  group_ends.assign(hl::group_count(), 0);
+  group_order.clear();
+  grouped.sorted.resize(tokens.size());
+
+  // count tokens of every group
+  for (const hl::token &token : tokens) {
+    if (group_ends[token.group]++ == 0) {
+      group_order.emplace_back(token.group);
+    }
+  }
+
+  // convert counts to begins of groups
+  for (size_t i = 0, offset = 0; i < group_order.size(); ++i) {
+    size_t count               = group_ends[group_order[i]];
+    group_ends[group_order[i]] = offset;
+    offset += count;
+  }
+
+  // after the loop begins of groups become ends of groups
+  for (const hl::token &token : tokens) {
+    grouped.sorted[group_ends[token.group]++] = &token;
+  }
+}
+
+static void append_tokens(std::string &          out,
+                          const hl::token_list &tokens) noexcept {
+  grouped_tokens grouped;
+  group_tokens(tokens, grouped);
+
+  const std::vector<hl::group_id> &group_order = grouped.group_order;
+
+  out += '{';
+  for (size_t i = 0, begin_of_group = 0; i < group_order.size(); ++i) {
+    size_t end_of_group = grouped.group_ends[group_order[i]];
+
+    if (i != 0) {
+      out += ',';
+    }
+
+    append_string(out, hl::group_name(group_order[i]));
+    out += ":[";
+    for (size_t j = begin_of_group; j < end_of_group; ++j) {
+      const hl::token_location &pos = grouped.sorted[j]->pos;
+
+      out += j == begin_of_group ? "[" : ",[";
+      append_int(out, pos[0]);
+      out += ',';
+      append_int(out, pos[1]);
+      out += ',';
+      append_int(out, pos[2]);
+      out += ']';
+    }
+    out += ']';
+
+    begin_of_group = end_of_group;
+  }
+  out += '}';
+}
+
+static void append_string(std::string &out, const std::string &str) noexcept {
+  static const char hex[] = "0123456789abcdef";
+
+  out += '"';
+
+  // copy parts, which don't need escaping, as is
+  const char *begin = str.data();
+  const char *end   = begin + str.size();
+  for (const char *pos = begin; pos != end; ++pos) {
+    unsigned char ch = *pos;
+    if (ch >= 0x20 && ch != '"' && ch != '\\') {
+      continue;
+    }
+
+    out.append(begin, pos);
+    begin = pos + 1;
+
+    switch (ch) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[ch >> 4];
+      out += hex[ch & 0xf];
+      break;
+    }
+  }
+  out.append(begin, end);
+
+  out += '"';
+}
+
+static void append_msgpack_uint(std::string &      out,
+                                char               code,
+                                unsigned long long value,
+                                unsigned int       bytes) noexcept {
+  out += code;
+  for (unsigned int i = bytes; i != 0; --i) {
+    out += static_cast<char>((value >> (8 * (i - 1))) & 0xff);
+  }
+}
+
+static void append_msgpack_int(std::string &out, long long value) noexcept {
+  if (value >= 0 && value < 0x80) {
+    out += static_cast<char>(value); // positive fixint
+  } else if (value >= 0 && value <= 0xff) {
+    append_msgpack_uint(out, '\xcc', value, 1);
+  } else if (value >= 0 && value <= 0xffff) {
+    append_msgpack_uint(out, '\xcd', value, 2);
+  } else if (value >= 0 && value <= 0xffffffffll) {
+    append_msgpack_uint(out, '\xce', value, 4);
+  } else if (value >= 0) {
+    append_msgpack_uint(out, '\xcf', value, 8);
+  } else if (value >= -32) {
+    out += static_cast<char>(value); // negative fixint
+  } else if (value >= -0x80) {
+    append_msgpack_uint(out, '\xd0', value, 1);
+  } else if (value >= -0x8000) {
+    append_msgpack_uint(out, '\xd1', value, 2);
+  } else if (value >= -0x80000000ll) {
+    append_msgpack_uint(out, '\xd2', value, 4);
+  } else {
+    append_msgpack_uint(out, '\xd3', value, 8);
+  }
+}
+
+static void append_msgpack_string(std::string &out,
+                                  const char * str,
+                                  size_t       size) noexcept {
+  if (size < 32) {
+    out += static_cast<char>(0xa0 | size); // fixstr
+  } else if (size <= 0xff) {
+    append_msgpack_uint(out, '\xd9', size, 1);
+  } else if (size <= 0xffff) {
+    append_msgpack_uint(out, '\xda', size, 2);
+  } else {
+    append_msgpack_uint(out, '\xdb', size, 4);
+  }
+
+  out.append(str, size);
+}
+
+static void append_msgpack_string(std::string &out, const char *str) noexcept {
+  append_msgpack_string(out, str, strlen(str));
+}
+
+static void append_msgpack_string(std::string &      out,
+                                  const std::string &str) noexcept {
+  append_msgpack_string(out, str.data(), str.size());
+}
+
+static void append_msgpack_array(std::string &out, size_t size) noexcept {
+  if (size < 16) {
+    out += static_cast<char>(0x90 | size); // fixarray
+  } else if (size <= 0xffff) {
+    append_msgpack_uint(out, '\xdc', size, 2);
+  } else {
+    append_msgpack_uint(out, '\xdd', size, 4);
+  }
+}
+
+static void append_msgpack_map(std::string &out, size_t size) noexcept {
+  if (size < 16) {
+    out += static_cast<char>(0x80 | size); // fixmap
+  } else if (size <= 0xffff) {
+    append_msgpack_uint(out, '\xde', size, 2);
+  } else {
+    append_msgpack_uint(out, '\xdf', size, 4);
+  }
+}
+
+static void append_msgpack_tokens(std::string &         out,
+                                  const hl::token_list &tokens) noexcept {
+  grouped_tokens grouped;
+  group_tokens(tokens, grouped);
+
+  const std::vector<hl::group_id> &group_order = grouped.group_order;
+
+  append_msgpack_map(out, group_order.size());
+  for (size_t i = 0, begin_of_group = 0; i < group_order.size(); ++i) {
+    size_t end_of_group = grouped.group_ends[group_order[i]];
+
+    append_msgpack_string(out, hl::group_name(group_order[i]));
+    append_msgpack_array(out, end_of_group - begin_of_group);
+    for (size_t j = begin_of_group; j < end_of_group; ++j) {
+      const hl::token_location &pos = grouped.sorted[j]->pos;
+
+      append_msgpack_array(out, 3);
+      append_msgpack_int(out, pos[0]);
+      append_msgpack_int(out, pos[1]);
+      append_msgpack_int(out, pos[2]);
+    }
+
+    begin_of_group = end_of_group;
+  }
+}
+
+static validator_map make_validators(bool is_request) {
+  validator_map retval;
+  for (const protocol_schemas &protocol : supported_protocols) {
+    retval[protocol.version].set_root_schema(json::parse(
+        is_request ? protocol.request_schema : protocol.response_schema));
+  }
+
+  return retval;
+}
+
+static const protocol_schemas *
+get_protocol(const std::string &version) noexcept {
+  for (const protocol_schemas &protocol : supported_protocols) {
+    if (version == protocol.version) {
+      return &protocol;
+    }
+  }
+
+  return nullptr;
+}
+
+static const json_validator *get_validator(const std::string &version,
+                                           bool is_request) noexcept {
+  try {
+    // schemas are compiled only once, at first call
+    static const validator_map request_validators  = make_validators(true);
+    static const validator_map response_validators = make_validators(false);
+
+    const validator_map &validators =
+        is_request ? request_validators : response_validators;
+
+    auto found = validators.find(version);
+    if (found != validators.end()) {
+      return &found->second;
+    }
+  } catch (std::exception &e) {
+    LOG_ERROR("can't compile json schema: %s", e.what());
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,172 @@
+#include "receive_buffer.hpp"
+#include <cstring>
+
+
+// buffer greater then the size will be released after handling all its data
+#define KEEP_BUF_SIZE 1024 * 1024 // 1Mb
+
+#define PREFIX_SIZE 5 // tag and 4 bytes of size
+
+
+namespace hl {
+receive_buffer::receive_buffer(char delimiter, size_t max_message_size) noexcept
+    : delimiter_{delimiter}
+    , max_message_size_{max_message_size}
+    , begin_{0}
+    , end_{0}
+    , scanned_{0}
+    , dropped_{0}
+    , skip_{false}
+    , length_prefix_{false}
+    , tag_{0}
+    , skip_size_{0}
+    , broken_{false} {
+}
+
+void receive_buffer::use_length_prefix(char tag) noexcept {
+  length_prefix_ = true;
+  tag_           = tag;
+}
+
+bool receive_buffer::broken() const noexcept {
+  return broken_;
+}
+
+char *receive_buffer::prepare(size_t size) {
+  if (begin_ == end_ && buf_.size() > KEEP_BUF_SIZE) {
+    std::vector<char>{}.swap(buf_);
+    begin_   = 0;
+    end_     = 0;
+    scanned_ = 0;
+  }
+
+  // move not handled data to begin of buffer
+  if (begin_ != 0) {
+    memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    scanned_ -= begin_;
+    begin_ = 0;
+  }
+
+  if (buf_.size() - end_ < size) {
+    size_t new_size = buf_.size() * 2;
+    buf_.resize(new_size > end_ + size ? new_size : end_ + size);
+  }
+
+  return buf_.data() + end_;
+}
+
+void receive_buffer::commit(size_t count) noexcept {
+  end_ += count;
+}
+
+bool receive_buffer::pop(const char *&message, size_t &size) noexcept {
+  if (length_prefix_) {
+    return pop_length_prefixed(message, size);
+  }
+
+  while (scanned_ != end_) {
+    char *start = buf_.data() + scanned_;
+    char *found =
+        static_cast<char *>(memchr(start, delimiter_, end_ - scanned_));
+
+    if (found == nullptr) {
+      scanned_ = end_;
+
+      if (max_message_size_ != 0 && end_ - begin_ > max_message_size_) {
+        dropped_ += end_ - begin_;
+        skip_    = true;
+        begin_   = end_;
+      }
+      break;
+    }
+
+    size_t message_begin = begin_;
+    size_t message_end   = found - buf_.data();
+
+    *found   = '\0';
+    begin_   = message_end + 1;
+    scanned_ = begin_;
+
+    if (skip_ || (max_message_size_ != 0 &&
+                  message_end - message_begin > max_message_size_)) {
+      dropped_ += message_end - message_begin;
+      skip_    = false;
+      continue;
+    }
+
+    message = buf_.data() + message_begin;
+    size    = message_end - message_begin;
+    return true;
+  }
+
+  return false;
+}
+
+bool receive_buffer::pop_length_prefixed(const char *&message,
+                                         size_t &     size) noexcept {
+  while (broken_ == false) {
+    // too large message is dropped without buffering
+    if (skip_size_ != 0) {
+      size_t count = end_ - begin_ < skip_size_ ? end_ - begin_ : skip_size_;
+      begin_ += count;
+      dropped_ += count;
+      skip_size_ -= count;
+      if (skip_size_ != 0) {
+        break;
+      }
+    }
+
+    if (end_ - begin_ < PREFIX_SIZE) {
+      break;
+    }
+
+    const unsigned char *prefix =
+        reinterpret_cast<const unsigned char *>(buf_.data() + begin_);
+    if (prefix[0] != static_cast<unsigned char>(tag_)) {
+      dropped_ += end_ - begin_;
+      begin_  = end_;
+      broken_ = true;
+      break;
+    }
+
+    size_t message_size = (static_cast<size_t>(prefix[1]) << 24) |
+                          (static_cast<size_t>(prefix[2]) << 16) |
+                          (static_cast<size_t>(prefix[3]) << 8) |
+                          static_cast<size_t>(prefix[4]);
+    if (max_message_size_ != 0 && message_size > max_message_size_) {
+      begin_ += PREFIX_SIZE;
+      skip_size_ = message_size;
+      continue;
+    }
+
+    if (end_ - begin_ - PREFIX_SIZE < message_size) {
+      break;
+    }
+
+    message = buf_.data() + begin_ + PREFIX_SIZE;
+    size    = message_size;
+    begin_ += PREFIX_SIZE + message_size;
+    scanned_ = begin_;
+    return true;
+  }
+
+  // scanned data is not used, but must be valid for moving data in prepare
+  scanned_ = begin_;
+  return false;
+}
+
+size_t receive_buffer::pending() const noexcept {
+  return end_ - begin_;
+}
+
+bool receive_buffer::full() const noexcept {
+  return max_message_size_ != 0 && end_ - begin_ > max_message_size_;
+}
+
+size_t receive_buffer::dropped() noexcept {
+  size_t retval = dropped_;
+  dropped_      = 0;
+  return retval;
+}
+} // namespace hl
@@ -0,0 +1,117 @@
+#include "response_cache.hpp"
+#include <sys/stat.h>
+
+
+/**\return stamp of files (see hl::hash_file_time) with their current times of
+ * modification, missing files have time 0
+ */
+static uint64_t read_stamp(const std::vector<std::string> &files) noexcept;
+
+
+namespace hl {
+response_cache::response_cache(size_t capacity) noexcept
+    : capacity_{capacity} {
+}
+
+token_list_ptr response_cache::get(const std::string &key,
+                                   uint64_t           content_hash) noexcept {
+  token_list_ptr tokens;
+  file_stamp_ptr dependencies;
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto found = slots_.find(key);
+    if (found == slots_.end() || found->second.content_hash != content_hash) {
+      return nullptr;
+    }
+
+    lru_.splice(lru_.begin(), lru_, found->second.lru_position);
+    tokens       = found->second.tokens;
+    dependencies = found->second.dependencies;
+  }
+
+  // without idle tracker nobody watches included files, so they are checked
+  // on every hit, without locking
+  if (dependencies == nullptr ||
+      read_stamp(dependencies->files) == dependencies->stamp) {
+    return tokens;
+  }
+
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  // entry could be replaced by other thread
+  auto found = slots_.find(key);
+  if (found != slots_.end() && found->second.tokens == tokens) {
+    lru_.erase(found->second.lru_position);
+    slots_.erase(found);
+  }
+  return nullptr;
+}
+
+void response_cache::put(const std::string &key,
+                         uint64_t           content_hash,
+                         token_list_ptr     tokens,
+                         file_stamp_ptr     dependencies) noexcept {
+  // tokens of removed entries can be still used by other threads, so they are
+  // released after unlocking
+  std::list<token_list_ptr> removed;
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (capacity_ == 0) {
+    return;
+  }
+
+  auto found = slots_.find(key);
+  if (found != slots_.end()) {
+    removed.emplace_back(std::move(found->second.tokens));
+    found->second.content_hash = content_hash;
+    found->second.tokens       = std::move(tokens);
+    found->second.dependencies = std::move(dependencies);
+    lru_.splice(lru_.begin(), lru_, found->second.lru_position);
+    return;
+  }
+
+  while (slots_.size() >= capacity_) {
+    auto oldest = slots_.find(lru_.back());
+    removed.emplace_back(std::move(oldest->second.tokens));
+    slots_.erase(oldest);
+    lru_.pop_back();
+  }
+
+  lru_.emplace_front(key);
+  slots_.emplace(key,
+                 slot{content_hash,
+                      std::move(tokens),
+                      std::move(dependencies),
+                      lru_.begin()});
+}
+
+void response_cache::erase_prefix(const std::string &prefix) noexcept {
+  std::list<token_list_ptr> removed;
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto                        iter = slots_.lower_bound(prefix);
+  while (iter != slots_.end() &&
+         iter->first.compare(0, prefix.size(), prefix) == 0) {
+    removed.emplace_back(std::move(iter->second.tokens));
+    lru_.erase(iter->second.lru_position);
+    iter = slots_.erase(iter);
+  }
+}
+} // namespace hl
+
+
+static uint64_t read_stamp(const std::vector<std::string> &files) noexcept {
+  uint64_t retval = hl::hash_seed;
+  for (const std::string &file : files) {
+    struct stat file_stat;
+    long long   time = 0;
+    if (stat(file.c_str(), &file_stat) == 0) {
+      time = file_stat.st_mtime;
+    }
+
+    retval = hl::hash_file_time(file, time, retval);
+  }
+  return retval;
+}
@@ -0,0 +1,67 @@
+#include "text_edit.hpp"
+#include <cstring>
+
+
+/**\brief convert line and column to offset in text
+ *
+ * \return false if the position is out of text. Position right after last
+ * character of line (or text) is valid
+ */
+static bool get_offset(const std::string &text,
+                       unsigned int       line,
+                       unsigned int       column,
+                       size_t &           offset) noexcept;
+
+
+namespace hl {
+bool apply_edits(std::string &text, const text_edit_list &edits) noexcept {
+  for (const text_edit &edit : edits) {
+    size_t begin = 0;
+    size_t end   = 0;
+    if (get_offset(text, edit.begin_line, edit.begin_column, begin) == false ||
+        get_offset(text, edit.end_line, edit.end_column, end) == false ||
+        end < begin) {
+      return false;
+    }
+
+    text.replace(begin, end - begin, edit.text);
+  }
+
+  return true;
+}
+} // namespace hl
+
+
+static bool get_offset(const std::string &text,
+                       unsigned int       line,
+                       unsigned int       column,
+                       size_t &           offset) noexcept {
+  if (line == 0 || column == 0) {
+    return false;
+  }
+
+  const char *begin      = text.data();
+  const char *end        = begin + text.size();
+  const char *line_begin = begin;
+  for (unsigned int i = 1; i < line; ++i) {
+    line_begin = static_cast<const char *>(
+        memchr(line_begin, '\n', end - line_begin));
+    if (line_begin == nullptr) {
+      return false;
+    }
+    ++line_begin;
+  }
+
+  const char *line_end =
+      static_cast<const char *>(memchr(line_begin, '\n', end - line_begin));
+  if (line_end == nullptr) {
+    line_end = end;
+  }
+
+  if (column - 1 > static_cast<size_t>(line_end - line_begin)) {
+    return false;
+  }
+
+  offset = (line_begin - begin) + column - 1;
+  return true;
+}
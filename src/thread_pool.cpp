@@ -0,0 +1,72 @@
+#include "thread_pool.hpp"
+#include "c_logs/log.h"
+#include <algorithm>
+
+
+namespace hl {
+thread_pool::thread_pool(size_t thread_count, size_t priority_count)
+    : tasks_(priority_count != 0 ? priority_count : 1)
+    , task_count_{0}
+    , stop_{false} {
+  threads_.reserve(thread_count);
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&thread_pool::run, this);
+  }
+}
+
+thread_pool::~thread_pool() noexcept {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+    for (std::deque<task> &queue : tasks_) {
+      queue.clear();
+    }
+    task_count_ = 0;
+  }
+  condition_.notify_all();
+
+  for (std::thread &thread : threads_) {
+    thread.join();
+  }
+}
+
+void thread_pool::push(task new_task, size_t priority) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    priority = std::min(priority, tasks_.size() - 1);
+    tasks_[priority].emplace_back(std::move(new_task));
+    ++task_count_;
+  }
+  condition_.notify_one();
+}
+
+void thread_pool::run() noexcept {
+  while (true) {
+    task current;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      condition_.wait(lock, [this]() {
+        return stop_ || task_count_ != 0;
+      });
+      if (stop_) {
+        return;
+      }
+
+      for (std::deque<task> &queue : tasks_) {
+        if (queue.empty() == false) {
+          current = std::move(queue.front());
+          queue.pop_front();
+          break;
+        }
+      }
+      --task_count_;
+    }
+
+    try {
+      current();
+    } catch (std::exception &e) {
+      LOG_ERROR("exception in thread pool task: %s", e.what());
+    }
+  }
+}
+} // namespace hl
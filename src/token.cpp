@@ -0,0 +1,82 @@
+#include "token.hpp"
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+
+// deque doesn't invalidate references to names after adding new one
+static std::deque<std::string>                        group_names;
+static std::unordered_map<std::string, hl::group_id> group_ids;
+static std::mutex                                     group_mutex;
+
+
+namespace hl {
+void diff_tokens(const token_list & previous,
+                 const token_list & current,
+                 const line_change &change,
+                 token_list &       added,
+                 token_list &       removed) noexcept {
+  auto less = [](const token &lhs, const token &rhs) {
+    return lhs.pos < rhs.pos || (lhs.pos == rhs.pos && lhs.group < rhs.group);
+  };
+  unsigned int shift = change.current_end - change.previous_end;
+
+  auto prev_iter = previous.begin();
+  auto cur_iter  = current.begin();
+  while (prev_iter != previous.end() && cur_iter != current.end()) {
+    unsigned int prev_row = prev_iter->pos[0];
+    unsigned int cur_row  = cur_iter->pos[0];
+    if (prev_row >= change.begin && prev_row < change.previous_end) {
+      removed.emplace_back(*prev_iter++);
+      continue;
+    }
+    if (cur_row >= change.begin && cur_row < change.current_end) {
+      added.emplace_back(*cur_iter++);
+      continue;
+    }
+
+    // unsigned overflow gives right row for negative shift too
+    token shifted = *prev_iter;
+    if (prev_row >= change.previous_end) {
+      shifted.pos[0] += shift;
+    }
+
+    if (less(shifted, *cur_iter)) {
+      removed.emplace_back(*prev_iter++);
+    } else if (less(*cur_iter, shifted)) {
+      added.emplace_back(*cur_iter++);
+    } else {
+      ++prev_iter;
+      ++cur_iter;
+    }
+  }
+
+  removed.insert(removed.end(), prev_iter, previous.end());
+  added.insert(added.end(), cur_iter, current.end());
+}
+
+group_id intern_group(const char *name) noexcept {
+  std::lock_guard<std::mutex> lock{group_mutex};
+
+  std::string key   = name;
+  auto        found = group_ids.find(key);
+  if (found != group_ids.end()) {
+    return found->second;
+  }
+
+  group_id id = group_names.size();
+  group_names.emplace_back(key);
+  group_ids.emplace(std::move(key), id);
+  return id;
+}
+
+const std::string &group_name(group_id id) noexcept {
+  std::lock_guard<std::mutex> lock{group_mutex};
+  return group_names[id];
+}
+
+size_t group_count() noexcept {
+  std::lock_guard<std::mutex> lock{group_mutex};
+  return group_names.size();
+}
+} // namespace hl
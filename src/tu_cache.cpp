@@ -0,0 +1,203 @@
+#include "tu_cache.hpp"
+#include "metrics.hpp"
+#include <cstring>
+#include <vector>
+
+namespace hl {
+parse_mode parse_mode_from_string(const char *str, bool &ok) noexcept {
+  ok = true;
+  if (strcmp(str, "full") == 0) {
+    return parse_mode::full;
+  } else if (strcmp(str, "preamble") == 0) {
+    return parse_mode::preamble;
+  }
+
+  ok = false;
+  return parse_mode::full;
+}
+
+
+tu_cache::tu_cache(parse_mode mode, size_t memory_budget) noexcept
+    : index_{clang_createIndex(0, 0)}
+    , mode_{mode}
+    , memory_budget_{memory_budget}
+    , stats_{0, 0, 0, 0, 0} {
+}
+
+tu_cache::~tu_cache() noexcept {
+  for (auto &pair : slots_) {
+    clang_disposeTranslationUnit(pair.second.value.translation_unit);
+  }
+  clang_disposeIndex(index_);
+}
+
+CXIndex tu_cache::index() const noexcept {
+  return index_;
+}
+
+unsigned tu_cache::parse_options() const noexcept {
+  switch (mode_) {
+  case parse_mode::full:
+    break;
+  case parse_mode::preamble:
+    return clang_defaultEditingTranslationUnitOptions() |
+           CXTranslationUnit_PrecompiledPreamble |
+           CXTranslationUnit_CreatePreambleOnFirstParse |
+           CXTranslationUnit_DetailedPreprocessingRecord;
+  }
+
+  return CXTranslationUnit_DetailedPreprocessingRecord;
+}
+
+bool tu_cache::take(const std::string &key, entry &taken) noexcept {
+  std::unique_lock<std::mutex> lock{mutex_};
+
+  // otherwise translation unit could be parsed again, and one of results
+  // would be lost (or older one would replace fresher)
+  released_.wait(lock, [this, &key]() { return taken_.count(key) == 0; });
+
+  auto found = slots_.find(key);
+  if (found == slots_.end()) {
+    ++stats_.misses;
+    hl::metrics::increment(hl::metrics::counter::cache_misses);
+    return false;
+  }
+
+  ++stats_.hits;
+  hl::metrics::increment(hl::metrics::counter::cache_hits);
+  --stats_.entries;
+  stats_.memory -= found->second.memory;
+
+  taken = std::move(found->second.value);
+  lru_.erase(found->second.lru_position);
+  slots_.erase(found);
+  taken_.emplace(key);
+  return true;
+}
+
+void tu_cache::put(const std::string &key, entry &&new_entry) noexcept {
+  // translation unit is owned by caller, so it can be measured without lock
+  size_t memory = memory_usage(new_entry.translation_unit) +
+                  new_entry.body.capacity() +
+                  new_entry.tokens.capacity() * sizeof(hl::token);
+
+  std::vector<CXTranslationUnit> disposed;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    taken_.erase(key);
+    if (stale_.erase(key) != 0) {
+      memory -= new_entry.body.capacity() +
+                new_entry.tokens.capacity() * sizeof(hl::token);
+      std::string{}.swap(new_entry.body);
+      hl::token_list{}.swap(new_entry.tokens);
+    }
+
+    auto found = slots_.find(key);
+    if (found != slots_.end()) {
+      disposed.emplace_back(found->second.value.translation_unit);
+      stats_.memory -= found->second.memory;
+      lru_.erase(found->second.lru_position);
+    } else {
+      found = slots_.emplace(key, slot{}).first;
+      ++stats_.entries;
+    }
+
+    lru_.emplace_front(key);
+    found->second.value        = std::move(new_entry);
+    found->second.memory       = memory;
+    found->second.lru_position = lru_.begin();
+    stats_.memory += memory;
+
+    while (memory_budget_ != 0 && stats_.memory > memory_budget_ &&
+           lru_.size() > 1) {
+      auto oldest = slots_.find(lru_.back());
+      disposed.emplace_back(oldest->second.value.translation_unit);
+
+      ++stats_.evictions;
+      hl::metrics::increment(hl::metrics::counter::cache_evictions);
+      --stats_.entries;
+      stats_.memory -= oldest->second.memory;
+
+      lru_.pop_back();
+      slots_.erase(oldest);
+    }
+  }
+  released_.notify_all();
+
+  // disposing can take some time, so it is done without lock
+  for (CXTranslationUnit translation_unit : disposed) {
+    clang_disposeTranslationUnit(translation_unit);
+  }
+}
+
+bool tu_cache::contains(const std::string &key) const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return slots_.find(key) != slots_.end();
+}
+
+void tu_cache::release(const std::string &key) noexcept {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    taken_.erase(key);
+    stale_.erase(key);
+  }
+  released_.notify_all();
+}
+
+void tu_cache::drop_tokens(const std::string &key) noexcept {
+  std::string    body;
+  hl::token_list tokens;
+
+  // tokens are released after unlocking
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto                        found = slots_.find(key);
+  if (found == slots_.end()) {
+    if (taken_.count(key) != 0) {
+      stale_.emplace(key);
+    }
+    return;
+  }
+
+  entry &value = found->second.value;
+  size_t freed =
+      value.body.capacity() + value.tokens.capacity() * sizeof(hl::token);
+  found->second.memory -= freed;
+  stats_.memory -= freed;
+  body.swap(value.body);
+  tokens.swap(value.tokens);
+}
+
+tu_cache::statistics tu_cache::stats() const noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return stats_;
+}
+
+std::string tu_cache::make_key(const char *buf_name,
+                               int         argc,
+                               const char *argv[]) noexcept {
+  // '\0' can not be a part of buffer name or flag, so use it as separator
+  std::string retval = buf_name;
+  for (int i = 0; i < argc; ++i) {
+    retval.push_back('\0');
+    retval.append(argv[i]);
+  }
+
+  return retval;
+}
+
+size_t tu_cache::memory_usage(CXTranslationUnit translation_unit) noexcept {
+  size_t            retval = 0;
+  CXTUResourceUsage usage  = clang_getCXTUResourceUsage(translation_unit);
+  for (unsigned i = 0; i < usage.numEntries; ++i) {
+    const CXTUResourceUsageEntry &usage_entry = usage.entries[i];
+    if (usage_entry.kind >= CXTUResourceUsage_MEMORY_IN_BYTES_BEGIN &&
+        usage_entry.kind <= CXTUResourceUsage_MEMORY_IN_BYTES_END) {
+      retval += usage_entry.amount;
+    }
+  }
+  clang_disposeCXTUResourceUsage(usage);
+
+  return retval;
+}
+} // namespace hl
@@ -0,0 +1,1376 @@
+#include "worker.hpp"
+#include "c_logs/log.h"
+#include "clang_tokenize.hpp"
+#include "compile_db.hpp"
+#include "disk_cache.hpp"
+#include "hash.hpp"
+#include "idle_tracker.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "receive_buffer.hpp"
+#include "response_cache.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+
+#define READ_SIZE         64 * 1024 // 64Kb
+#define DELIMITER         '\n'
+#define FRAME_TAG         'M' // starts every msgpack message
+#define FRAME_PREFIX_SIZE 5   // tag and 4 bytes of size
+#define MAX_EVENTS        64
+
+// background reparse of idle buffers has lower priority then all requests
+#define IDLE_PRIORITY static_cast<size_t>(hl::priority::count)
+#define PRIORITIES    (IDLE_PRIORITY + 1)
+
+// buffer exceeded budget of resources is tokenized lexically during the time
+#define DEGRADED_TIMEOUT std::chrono::minutes{5}
+
+// result is written to disk cache only after the time without newer results
+// for the buffer, so editing doesn't write file on every change
+#define DISK_STORE_DELAY std::chrono::seconds{2}
+
+
+// tokens from latest response for buffer, needed for diff responses
+struct sent_tokens {
+  unsigned int          begin_line;
+  unsigned int          end_line;
+  hl::token_list        tokens;
+  std::vector<uint64_t> lines; // hashes of lines of the buffer
+};
+
+// set by main thread, if result of request is not needed anymore
+using cancel_flag = std::shared_ptr<std::atomic<bool>>;
+
+struct connection {
+  connection(int           sock_,
+             int           port_,
+             unsigned long serial_,
+             size_t        max_message_size) noexcept
+      : sock{sock_}
+      , port{port_}
+      , serial{serial_}
+      , input{DELIMITER, max_message_size}
+      , written{0}
+      , events{EPOLLIN}
+      , closed{false}
+      , eof{false}
+      , format{hl::wire_format::json}
+      , format_detected{false} {
+  }
+
+  int                                sock;
+  int                                port;
+  unsigned long                      serial; // socket can be reused
+  hl::receive_buffer                 input;
+  std::list<hl::request>             requests; // not handled yet
+  std::map<std::string, cancel_flag> running;  // by request slots
+  std::string                        output;   // reused for all responses
+  size_t                             written;  // already written part
+  uint32_t                           events;   // registered in epoll
+  bool                               closed;
+  bool                               eof;    // client doesn't send anymore
+  hl::wire_format                    format; // detected by first byte
+  bool                               format_detected;
+  std::map<std::string, sent_tokens> sent;   // by buffer names
+  std::map<std::string, std::string> bodies; // for incremental requests
+};
+
+// translation unit, used for handling of request
+struct unit_info {
+  std::string              key; // empty if translation unit was not used
+  std::vector<std::string> args;
+  std::vector<std::string> includes; // only if translation unit was created
+};
+
+// result for disk cache, it is stored after sending of response
+struct disk_result {
+  std::string                           key; // empty if nothing to store
+  std::shared_ptr<const hl::token_list> tokens;
+};
+
+// latest result of translation unit, which waits for writing to disk cache
+struct pending_store {
+  std::string                           buf_body;
+  std::shared_ptr<const hl::token_list> tokens;
+  std::chrono::steady_clock::time_point due;
+};
+
+using pending_stores = std::map<std::string, pending_store>; // by unit keys
+
+// handled request, returned from thread pool to main thread
+struct completion {
+  int           sock;
+  unsigned long serial;
+  hl::request   req;
+  hl::response  resp;
+  cancel_flag   cancelled;
+  unit_info     unit;
+  disk_result   stored;
+
+  std::chrono::steady_clock::time_point start;
+};
+
+// finished background reparse of idle buffer
+struct reparse_completion {
+  std::string              key;
+  std::vector<std::string> includes;
+};
+
+/**\brief completions from threads of pool, main thread is notified about
+ * new completions by the eventfd
+ */
+struct completion_queue {
+  completion_queue() noexcept
+      : event_fd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {
+  }
+  ~completion_queue() noexcept {
+    if (event_fd >= 0) {
+      close(event_fd);
+    }
+  }
+
+  int                           event_fd;
+  std::mutex                    mutex;
+  std::list<completion>         completions;
+  std::list<reparse_completion> reparsed;
+};
+
+/**\brief keys of translation units, which exceeded budget of resources,
+ * with time when the budget was exceeded
+ */
+struct degraded_units {
+  std::mutex                                                   mutex;
+  std::map<std::string, std::chrono::steady_clock::time_point> keys;
+};
+
+using connection_map = std::map<int, connection>;
+
+// shared between all connections of the worker
+struct worker_context {
+  const hl::worker_options &options;
+  hl::tu_cache &            cache;
+  hl::compile_db *          compile_db; // nullptr if not used
+  hl::disk_cache *          disk_cache; // nullptr if not used
+  hl::response_cache &      responses;
+  hl::idle_tracker *        tracker; // nullptr if idle reparse is disabled
+  hl::thread_pool &         pool;
+  completion_queue &        queue;
+  degraded_units &          degraded;
+  pending_stores &          stores; // used only by main thread
+};
+
+static bool handle_input(connection &conn, const hl::worker_options &options);
+
+/**\brief start handling of requests on thread pool. Only one request in
+ * every slot (see request_slot) is handled at the same time
+ */
+static void dispatch(connection &conn, const worker_context &context);
+
+/**\brief write responses for completed requests to its connections
+ */
+static void handle_completions(connection_map &      connections,
+                               const worker_context &context,
+                               int                   epoll_fd);
+
+/**\brief start background reparse of idle buffers
+ */
+static void dispatch_idle(const worker_context &context);
+
+/**\brief files included by translation unit were changed, so cached results
+ * of its tokenization are not valid anymore
+ */
+static void invalidate_unit(const worker_context &context,
+                            const std::string &   key);
+
+/**\brief close socket and cancel all running requests of the connection
+ */
+static void close_connection(connection_map &          connections,
+                             connection_map::iterator &found);
+
+static void log_cache_stats(const hl::tu_cache &cache, bool at_finish);
+
+/**\return port of client, or 0 for unix domain socket
+ */
+static int get_port(const sockaddr_storage &addr) noexcept;
+
+static bool handle_output(connection &conn, int epoll_fd);
+
+/**\brief connection, closed by client, can be closed after all responses are
+ * sent
+ */
+static bool is_finished(const connection &conn) noexcept;
+
+static bool receive(connection &conn);
+
+static void enqueue_requests(connection &              conn,
+                             const hl::worker_options &options);
+
+/**\brief append response to output in format of the connection
+ */
+static void write_response(connection &conn, const hl::response &resp);
+
+/**\brief write response for invalid request, which is empty message
+ */
+static void write_empty_response(connection &conn);
+
+/**\brief save body of the buffer from request, or restore body of
+ * incremental request by applying its edits to saved body
+ *
+ * \return false if body can not be restored
+ */
+static bool update_body(connection &conn, hl::request &req);
+
+/**\brief replace tokens in response by difference with previous response for
+ * same buffer, if the difference is less then full response
+ */
+static void make_diff(connection &       conn,
+                      const hl::request &req,
+                      hl::response &     resp);
+
+/**\return range of lines between common prefix and common suffix of
+ * previous and current lines
+ */
+static hl::line_change
+find_line_change(const std::vector<uint64_t> &previous,
+                 const std::vector<uint64_t> &current) noexcept;
+
+/**\return name of slot for requests of the buffer, only one request in every
+ * slot is handled at the same time, newer request replaces older ones. Lexical
+ * requests have own slot, so they don't replace complete ones and vice versa
+ */
+static std::string request_slot(const std::string &buf_name, bool lexical);
+
+/**\return response without tokens for the request
+ */
+static hl::response make_response(const hl::request &req);
+
+/**\brief remove tokens, which are out of range of lines, 0 means begin (or
+ * end) of the buffer
+ */
+static void filter_range(hl::token_list &tokens,
+                         unsigned int    begin_line,
+                         unsigned int    end_line);
+
+/**\param unit filled if translation unit was used for the request
+ * \param stored filled if result must be stored in disk cache
+ */
+static hl::response process(const hl::request &        req,
+                           const worker_context &     context,
+                           const hl::cancel_callback &cancel,
+                           unit_info &                unit,
+                           disk_result &              stored);
+
+/**\brief replace pending results for disk cache by results of completions,
+ * so only latest result of every buffer is written after DISK_STORE_DELAY
+ */
+static void store_results(const worker_context & context,
+                          std::list<completion> &completions);
+
+/**\brief write pending results, which are due, in disk cache on thread pool
+ * with lowest priority, so writing of files doesn't delay responses
+ *
+ * \param all if true, then all pending results are written immediately in
+ * current thread
+ */
+static void flush_stores(const worker_context &context, bool all);
+
+/**\return timeout for epoll_wait in ms until next pending result is due, -1
+ * if there is no pending results
+ */
+static int get_store_timeout(const pending_stores &stores) noexcept;
+
+/**\return true if the key exceeded budget less then DEGRADED_TIMEOUT ago
+ */
+static bool is_degraded(degraded_units &units, const std::string &key);
+
+static void mark_degraded(degraded_units &units, const std::string &key);
+
+
+
+namespace hl {
+int run_worker(const worker_options &options) noexcept {
+  hl::tu_cache                        cache{options.mode, options.cache_memory};
+  std::unique_ptr<hl::compile_db>     compile_db;
+  std::unique_ptr<hl::disk_cache>     disk_cache;
+  hl::response_cache                  responses{options.response_cache_size};
+  std::unique_ptr<hl::idle_tracker>   tracker;
+  completion_queue                    queue;
+  degraded_units                      degraded;
+  pending_stores                      stores;
+  hl::thread_pool                     pool{options.thread_count, PRIORITIES};
+  connection_map                      connections;
+  unsigned long                       next_serial = 0;
+  int                                 epoll_fd  = -1;
+  int                                 signal_fd = -1;
+  sigset_t                            sigmask;
+  epoll_event                         event;
+  std::array<epoll_event, MAX_EVENTS> events;
+  int                                 count  = 0;
+  bool                                done   = false;
+  int                                 retval = EXIT_SUCCESS;
+
+  if (options.compile_commands != nullptr) {
+    compile_db.reset(new hl::compile_db{options.compile_commands});
+  }
+  if (options.cache_dir != nullptr) {
+    disk_cache.reset(new hl::disk_cache{options.cache_dir});
+  }
+  if (options.idle_reparse != 0) {
+    tracker.reset(new hl::idle_tracker{
+        std::chrono::milliseconds{options.idle_reparse}});
+    if (tracker->valid() == false) {
+      LOG_ERROR("can't create inotify or timer: %s", strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+  worker_context context{options,
+                         cache,
+                         compile_db.get(),
+                         disk_cache.get(),
+                         responses,
+                         tracker.get(),
+                         pool,
+                         queue,
+                         degraded,
+                         stores};
+
+  // SIGINT and SIGTERM are blocked by main process, so handle them as events
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGINT);
+  sigaddset(&sigmask, SIGTERM);
+  signal_fd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd < 0) {
+    LOG_ERROR("can't create signalfd: %s", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    LOG_ERROR("can't create epoll: %s", strerror(errno));
+    close(signal_fd);
+    return EXIT_FAILURE;
+  }
+
+  event.events  = EPOLLIN;
+  event.data.fd = signal_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) != 0) {
+    LOG_ERROR("can't add signalfd to epoll: %s", strerror(errno));
+    retval = EXIT_FAILURE;
+    goto Finish;
+  }
+
+  event.events  = EPOLLIN;
+  event.data.fd = queue.event_fd;
+  if (queue.event_fd < 0 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, queue.event_fd, &event) != 0) {
+    LOG_ERROR("can't add eventfd to epoll: %s", strerror(errno));
+    retval = EXIT_FAILURE;
+    goto Finish;
+  }
+
+  for (int fd : {tracker ? tracker->inotify_fd() : -1,
+                 tracker ? tracker->timer_fd() : -1}) {
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    if (fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      LOG_ERROR("can't add idle tracker to epoll: %s", strerror(errno));
+      retval = EXIT_FAILURE;
+      goto Finish;
+    }
+  }
+
+  // exclusive flag prevents waking up of all workers by every connection
+  event.events  = EPOLLIN | EPOLLEXCLUSIVE;
+  event.data.fd = options.listener;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, options.listener, &event) != 0) {
+    LOG_ERROR("can't add listener to epoll: %s", strerror(errno));
+    retval = EXIT_FAILURE;
+    goto Finish;
+  }
+
+  while (done == false) {
+    count = epoll_wait(epoll_fd,
+                       events.data(),
+                       events.size(),
+                       get_store_timeout(stores));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0) {
+      LOG_ERROR("epoll error: %s", strerror(errno));
+      retval = EXIT_FAILURE;
+      break;
+    }
+
+    flush_stores(context, false);
+
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+
+      if (fd == signal_fd) {
+        LOG_DEBUG("worker got signal for finishing");
+        done = true;
+        break;
+      }
+
+      if (fd == queue.event_fd) {
+        handle_completions(connections, context, epoll_fd);
+        continue;
+      }
+
+      if (tracker && fd == tracker->inotify_fd()) {
+        for (const std::string &key : tracker->handle_file_changes()) {
+          invalidate_unit(context, key);
+        }
+        continue;
+      }
+
+      if (tracker && fd == tracker->timer_fd()) {
+        dispatch_idle(context);
+        continue;
+      }
+
+      if (fd == options.listener) {
+        // accept new connection
+        sockaddr_storage in_addr;
+        socklen_t        sock_len = sizeof(in_addr);
+        int              in_sock  = accept4(options.listener,
+                                (sockaddr *)&in_addr,
+                                &sock_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (in_sock < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          // accepted by other worker
+          continue;
+        } else if (in_sock < 0) {
+          LOG_ERROR("can't accept incomming socket: %s", strerror(errno));
+          continue;
+        }
+
+        event.events  = EPOLLIN;
+        event.data.fd = in_sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in_sock, &event) != 0) {
+          LOG_ERROR("can't add connection to epoll: %s", strerror(errno));
+          close(in_sock);
+          continue;
+        }
+
+        int in_port = get_port(in_addr);
+        LOG_INFO("accepted connection from port: %d", in_port);
+
+        connections.emplace(std::piecewise_construct,
+                            std::forward_as_tuple(in_sock),
+                            std::forward_as_tuple(in_sock,
+                                                  in_port,
+                                                  next_serial++,
+                                                  options.max_message_size));
+        continue;
+      }
+
+
+      // handle connection
+      auto found = connections.find(fd);
+      if (found == connections.end()) {
+        continue;
+      }
+
+      connection &conn = found->second;
+      bool        ok   = true;
+      if (conn.eof && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+        // responses can't be delivered anymore
+        ok = false;
+      }
+      if (ok && (events[i].events & EPOLLOUT)) {
+        ok = handle_output(conn, epoll_fd);
+      }
+      if (ok && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        ok = handle_input(conn, options) && handle_output(conn, epoll_fd);
+      }
+
+      if (ok == false) {
+        close_connection(connections, found);
+        continue;
+      }
+
+      dispatch(conn, context);
+      if (is_finished(conn)) {
+        close_connection(connections, found);
+      }
+    }
+  }
+
+
+Finish:
+  // running requests are cancelled, so pool will be destroyed quickly
+  for (auto iter = connections.begin(); iter != connections.end();) {
+    close_connection(connections, iter);
+  }
+
+  flush_stores(context, true);
+
+  close(epoll_fd);
+  close(signal_fd);
+
+  log_cache_stats(cache, true);
+  return retval;
+}
+} // namespace hl
+
+
+static bool handle_input(connection &conn, const hl::worker_options &options) {
+  if (receive(conn) == false) {
+    return false;
+  }
+
+  enqueue_requests(conn, options);
+
+  return conn.closed == false;
+}
+
+static void dispatch(connection &conn, const worker_context &context) {
+  for (auto iter = conn.requests.begin(); iter != conn.requests.end();) {
+    if (conn.running.count(request_slot(iter->buf_name, iter->lexical)) != 0) {
+      ++iter;
+      continue;
+    }
+
+    std::shared_ptr<completion> job = std::make_shared<completion>();
+    job->sock                       = conn.sock;
+    job->serial                     = conn.serial;
+    job->req                        = std::move(*iter);
+    job->cancelled = std::make_shared<std::atomic<bool>>(false);
+    job->start     = std::chrono::steady_clock::now();
+    iter           = conn.requests.erase(iter);
+
+    conn.running[request_slot(job->req.buf_name, job->req.lexical)] =
+        job->cancelled;
+
+    // context contains only references, so it can be copied
+    hl::thread_pool::task task = [job, context]() {
+      completion_queue &  queue  = context.queue;
+      cancel_flag         flag   = job->cancelled;
+      hl::cancel_callback cancel = [flag]() {
+        return flag->load();
+      };
+
+      job->resp =
+          process(job->req, context, cancel, job->unit, job->stored);
+
+      {
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.completions.emplace_back(std::move(*job));
+      }
+
+      uint64_t value = 1;
+      if (write(queue.event_fd, &value, sizeof(value)) != sizeof(value)) {
+        LOG_ERROR("can't notify about completion: %s", strerror(errno));
+      }
+    };
+    context.pool.push(std::move(task), static_cast<size_t>(job->req.priority));
+  }
+}
+
+static void dispatch_idle(const worker_context &context) {
+  std::list<hl::idle_tracker::job> jobs =
+      context.tracker->idle_jobs(context.cache);
+  for (hl::idle_tracker::job &idle : jobs) {
+    LOG_DEBUG("background reparse of %s", idle.buf_name.c_str());
+
+    std::shared_ptr<hl::idle_tracker::job> job =
+        std::make_shared<hl::idle_tracker::job>(std::move(idle));
+    hl::thread_pool::task task = [job, context]() {
+      completion_queue &        queue = context.queue;
+      std::vector<const char *> argv;
+      reparse_completion        result;
+
+      for (const std::string &arg : job->args) {
+        argv.emplace_back(arg.c_str());
+      }
+
+      result.key = job->key;
+
+      hl::clang_reparse(context.cache,
+                        job->buf_name.c_str(),
+                        job->buf_body,
+                        argv.size(),
+                        argv.data(),
+                        result.includes);
+
+      {
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.reparsed.emplace_back(std::move(result));
+      }
+
+      uint64_t value = 1;
+      if (write(queue.event_fd, &value, sizeof(value)) != sizeof(value)) {
+        LOG_ERROR("can't notify about completion: %s", strerror(errno));
+      }
+    };
+    context.pool.push(std::move(task), IDLE_PRIORITY);
+  }
+}
+
+static void invalidate_unit(const worker_context &context,
+                            const std::string &   key) {
+  // keys of response cache start with key of translation unit
+  context.responses.erase_prefix(key + '\0');
+  context.cache.drop_tokens(key);
+}
+
+static void handle_completions(connection_map &      connections,
+                               const worker_context &context,
+                               int                   epoll_fd) {
+  completion_queue &            queue = context.queue;
+  uint64_t                      value = 0;
+  std::list<completion>         completions;
+  std::list<reparse_completion> reparsed;
+
+  if (read(queue.event_fd, &value, sizeof(value)) != sizeof(value)) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    completions.swap(queue.completions);
+    reparsed.swap(queue.reparsed);
+  }
+
+  for (reparse_completion &done : reparsed) {
+    context.tracker->finish(done.key, done.includes);
+  }
+
+  for (completion &done : completions) {
+    // translation unit is fresh after the request, even if connection was
+    // closed
+    if (context.tracker != nullptr && done.unit.key.empty() == false) {
+      context.tracker->touch(done.unit.key,
+                             done.req.buf_name,
+                             std::string{done.req.buf_body},
+                             std::move(done.unit.args),
+                             done.unit.includes);
+    }
+
+    auto found = connections.find(done.sock);
+    if (found == connections.end() || found->second.serial != done.serial) {
+      // connection was closed
+      continue;
+    }
+
+    connection &conn = found->second;
+    conn.running.erase(request_slot(done.req.buf_name, done.req.lexical));
+
+    hl::metrics::increment(hl::metrics::counter::requests);
+    if (done.cancelled->load()) {
+      LOG_DEBUG("ignore response for old request: %d",
+                done.req.message_number);
+      hl::metrics::increment(hl::metrics::counter::cancelled);
+    } else {
+      if (done.req.diff_mode) {
+        make_diff(conn, done.req, done.resp);
+      }
+      write_response(conn, done.resp);
+
+      // fast lexical result must not replace complete one
+      auto lexical = conn.running.find(request_slot(done.req.buf_name, true));
+      if (done.req.lexical == false && lexical != conn.running.end()) {
+        lexical->second->store(true);
+      }
+      hl::metrics::record(hl::metrics::stage::request,
+                          std::chrono::steady_clock::now() - done.start);
+    }
+
+    dispatch(conn, context);
+    if (handle_output(conn, epoll_fd) == false || is_finished(conn)) {
+      close_connection(connections, found);
+    }
+  }
+
+  store_results(context, completions);
+
+  log_cache_stats(context.cache, false);
+}
+
+static void store_results(const worker_context & context,
+                          std::list<completion> &completions) {
+  auto due = std::chrono::steady_clock::now() + DISK_STORE_DELAY;
+  for (completion &done : completions) {
+    if (done.stored.key.empty()) {
+      continue;
+    }
+
+    // body of request is not needed anymore
+    pending_store &pending = context.stores[done.stored.key];
+    pending.buf_body       = std::move(done.req.buf_body);
+    pending.tokens         = std::move(done.stored.tokens);
+    pending.due            = due;
+  }
+}
+
+static void flush_stores(const worker_context &context, bool all) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto iter = context.stores.begin(); iter != context.stores.end();) {
+    if (all == false && iter->second.due > now) {
+      ++iter;
+      continue;
+    }
+
+    if (all) {
+      context.disk_cache->store(iter->first,
+                                iter->second.buf_body,
+                                *iter->second.tokens);
+      iter = context.stores.erase(iter);
+      continue;
+    }
+
+    std::string                    key = iter->first;
+    std::shared_ptr<pending_store> job =
+        std::make_shared<pending_store>(std::move(iter->second));
+    hl::thread_pool::task task = [key, job, context]() {
+      context.disk_cache->store(key, job->buf_body, *job->tokens);
+    };
+    context.pool.push(std::move(task), IDLE_PRIORITY);
+    iter = context.stores.erase(iter);
+  }
+}
+
+static int get_store_timeout(const pending_stores &stores) noexcept {
+  if (stores.empty()) {
+    return -1;
+  }
+
+  auto due = stores.begin()->second.due;
+  for (const auto &pair : stores) {
+    due = std::min(due, pair.second.due);
+  }
+
+  // rounded up, so results are due after waking up
+  auto left = due - std::chrono::steady_clock::now();
+  auto ms   = std::chrono::duration_cast<std::chrono::milliseconds>(left) +
+            std::chrono::milliseconds{1};
+  return std::max(0, static_cast<int>(ms.count()));
+}
+
+static int get_port(const sockaddr_storage &addr) noexcept {
+  switch (addr.ss_family) {
+  case AF_INET:
+    return ntohs(reinterpret_cast<const sockaddr_in &>(addr).sin_port);
+  case AF_INET6:
+    return ntohs(reinterpret_cast<const sockaddr_in6 &>(addr).sin6_port);
+  default:
+    return 0;
+  }
+}
+
+static void log_cache_stats(const hl::tu_cache &cache, bool at_finish) {
+  hl::tu_cache::statistics stats = cache.stats();
+  if (at_finish) {
+    LOG_INFO("tu cache hits: %zu, misses: %zu, evictions: %zu",
+             stats.hits,
+             stats.misses,
+             stats.evictions);
+  } else {
+    LOG_DEBUG("tu cache hits: %zu, misses: %zu, evictions: %zu, entries: %zu, "
+              "memory: %.1fMb",
+              stats.hits,
+              stats.misses,
+              stats.evictions,
+              stats.entries,
+              stats.memory / (1024. * 1024.));
+  }
+}
+
+static void close_connection(connection_map &          connections,
+                             connection_map::iterator &found) {
+  connection &conn = found->second;
+  for (auto &pair : conn.running) {
+    pair.second->store(true);
+  }
+
+  // closing of socket also removes it from epoll
+  LOG_INFO("close connection from port: %d", conn.port);
+  close(conn.sock);
+  found = connections.erase(found);
+}
+
+static bool receive(connection &conn) {
+  int count = 0;
+
+  // read all available data
+  while (true) {
+    char *dst = conn.input.prepare(READ_SIZE);
+
+    count = read(conn.sock, dst, READ_SIZE);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (count < 0) {
+      LOG_ERROR("read error: %s", strerror(errno));
+      return false;
+    } else if (count == 0) {
+      // requests, which are already received, are still handled
+      LOG_INFO("eof from connection with port: %d", conn.port);
+      conn.eof = true;
+      break;
+    }
+
+    LOG_DEBUG("readen: %.1fKb", count / 1024.);
+
+    // json requests start with '[', so client can't use both formats
+    if (conn.format_detected == false) {
+      conn.format_detected = true;
+      if (dst[0] == FRAME_TAG) {
+        LOG_DEBUG("uses msgpack for connection with port: %d", conn.port);
+        conn.format = hl::wire_format::msgpack;
+        conn.input.use_length_prefix(FRAME_TAG);
+      }
+    }
+
+    conn.input.commit(count);
+
+    // client can send data without delimiter faster then it is read, so rest
+    // of data is read after handling of the buffer
+    if (conn.input.full()) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+static void enqueue_requests(connection &              conn,
+                             const hl::worker_options &options) {
+  const char *message      = nullptr;
+  size_t      message_size = 0;
+  size_t      dropped      = 0;
+
+  while (conn.input.pop(message, message_size)) {
+    hl::request req;
+    bool        ok =
+        conn.format == hl::wire_format::msgpack
+            ? hl::parse_msgpack_request(message,
+                                        message_size,
+                                        req,
+                                        options.validate_requests)
+            : hl::parse_request(message, req, options.validate_requests);
+    if (ok == false) {
+      write_empty_response(conn);
+      continue;
+    }
+
+    if (req.edits_mode && update_body(conn, req) == false) {
+      LOG_WARNING("can't apply edits for buffer: %s", req.buf_name.c_str());
+
+      hl::response resp  = make_response(req);
+      resp.return_code   = 5;
+      resp.error_message = "can't apply edits, full buffer body required";
+
+      conn.sent.erase(req.buf_name);
+      write_response(conn, resp);
+      continue;
+    }
+
+    // only latest request in every slot will be handled
+    std::string slot    = request_slot(req.buf_name, req.lexical);
+    auto        running = conn.running.find(slot);
+    if (running != conn.running.end()) {
+      running->second->store(true);
+    }
+    for (auto iter = conn.requests.begin(); iter != conn.requests.end();) {
+      if (request_slot(iter->buf_name, iter->lexical) == slot) {
+        LOG_DEBUG("ignore old request: %d", iter->message_number);
+        iter = conn.requests.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+
+    conn.requests.emplace_back(std::move(req));
+  }
+
+  if (conn.input.broken() && conn.closed == false) {
+    LOG_ERROR("invalid message frame from connection with port: %d",
+              conn.port);
+    conn.closed = true;
+  }
+
+  // client, which doesn't respect the limit, can send data infinitely
+  dropped = conn.input.dropped();
+  if (dropped != 0 && conn.closed == false) {
+    LOG_ERROR("message size limit exceeded by %.1fKb of data from connection "
+              "with port: %d",
+              dropped / 1024.,
+              conn.port);
+    conn.closed = true;
+  }
+}
+
+static void write_response(connection &conn, const hl::response &resp) {
+  hl::metrics::scoped_timer timer{hl::metrics::stage::serialize};
+
+  if (conn.format == hl::wire_format::json) {
+    hl::serialize_response(resp, conn.output);
+    conn.output += DELIMITER;
+    return;
+  }
+
+  // size of message is known only after serialization
+  size_t prefix = conn.output.size();
+  conn.output.append(FRAME_PREFIX_SIZE, FRAME_TAG);
+  hl::serialize_msgpack_response(resp, conn.output);
+
+  size_t size = conn.output.size() - prefix - FRAME_PREFIX_SIZE;
+  for (int i = 0; i < 4; ++i) {
+    conn.output[prefix + 1 + i] = static_cast<char>(size >> (8 * (3 - i)));
+  }
+}
+
+static void write_empty_response(connection &conn) {
+  if (conn.format == hl::wire_format::json) {
+    conn.output += DELIMITER;
+  } else {
+    conn.output += FRAME_TAG;
+    conn.output.append(4, '\0');
+  }
+}
+
+static bool update_body(connection &conn, hl::request &req) {
+  if (req.incremental == false) {
+    conn.bodies[req.buf_name] = req.buf_body;
+    return true;
+  }
+
+  auto found = conn.bodies.find(req.buf_name);
+  if (found == conn.bodies.end()) {
+    return false;
+  }
+
+  if (hl::apply_edits(found->second, req.edits) == false) {
+    // body is partially changed, so it is not valid anymore
+    conn.bodies.erase(found);
+    return false;
+  }
+
+  req.buf_body    = found->second;
+  req.incremental = false;
+  req.edits.clear();
+  return true;
+}
+
+static void make_diff(connection &       conn,
+                      const hl::request &req,
+                      hl::response &     resp) {
+  if (resp.return_code != 0) {
+    // client must not rely on previous tokens after error
+    conn.sent.erase(req.buf_name);
+    return;
+  }
+
+  std::vector<uint64_t> lines = hl::hash_lines(req.buf_body);
+
+  auto found = conn.sent.find(req.buf_name);
+  if (found != conn.sent.end() && found->second.begin_line == req.begin_line &&
+      found->second.end_line == req.end_line) {
+    hl::line_change change = find_line_change(found->second.lines, lines);
+    hl::token_list  added;
+    hl::token_list  removed;
+    hl::diff_tokens(found->second.tokens, resp.tokens, change, added, removed);
+
+    if (added.size() + removed.size() < resp.tokens.size()) {
+      found->second.tokens = std::move(resp.tokens);
+      found->second.lines  = std::move(lines);
+      resp.tokens          = std::move(added);
+      resp.removed_tokens  = std::move(removed);
+      resp.is_diff         = true;
+
+      // client shifts rows of its tokens, which are after the change
+      resp.shift_line = change.previous_end;
+      resp.shift_rows = static_cast<int>(change.current_end) -
+                        static_cast<int>(change.previous_end);
+      return;
+    }
+  }
+
+  sent_tokens &sent = conn.sent[req.buf_name];
+  sent.begin_line   = req.begin_line;
+  sent.end_line     = req.end_line;
+  sent.tokens       = resp.tokens;
+  sent.lines        = std::move(lines);
+}
+
+static hl::line_change
+find_line_change(const std::vector<uint64_t> &previous,
+                 const std::vector<uint64_t> &current) noexcept {
+  size_t common = std::min(previous.size(), current.size());
+  size_t prefix = 0;
+  size_t suffix = 0;
+
+  while (prefix < common && previous[prefix] == current[prefix]) {
+    ++prefix;
+  }
+  while (suffix < common - prefix &&
+         previous[previous.size() - suffix - 1] ==
+             current[current.size() - suffix - 1]) {
+    ++suffix;
+  }
+
+  // rows of tokens start from 1
+  hl::line_change change;
+  change.begin        = prefix + 1;
+  change.previous_end = previous.size() - suffix + 1;
+  change.current_end  = current.size() - suffix + 1;
+  return change;
+}
+
+static bool handle_output(connection &conn, int epoll_fd) {
+  while (conn.written != conn.output.size()) {
+    hl::metrics::scoped_timer timer{hl::metrics::stage::write};
+
+    // client can close connection before all responses are written
+    int count = send(conn.sock,
+                     conn.output.data() + conn.written,
+                     conn.output.size() - conn.written,
+                     MSG_NOSIGNAL);
+    timer.stop();
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (count < 0) {
+      LOG_ERROR("failure during writting response: %s", strerror(errno));
+      return false;
+    }
+
+    LOG_DEBUG("written: %.1fKb", count / 1024.);
+    conn.written += count;
+  }
+
+  // clear keeps allocated memory, so it will be reused by next responses
+  if (conn.written == conn.output.size()) {
+    conn.output.clear();
+    conn.written = 0;
+  }
+
+  // wait for socket writability only if some data is not written yet, socket
+  // is always readable after eof
+  uint32_t events = 0;
+  if (conn.eof == false) {
+    events |= EPOLLIN;
+  }
+  if (conn.output.empty() == false) {
+    events |= EPOLLOUT;
+  }
+  if (events != conn.events) {
+    epoll_event event;
+    event.events  = events;
+    event.data.fd = conn.sock;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.sock, &event) != 0) {
+      LOG_ERROR("can't modify connection in epoll: %s", strerror(errno));
+      return false;
+    }
+
+    conn.events = events;
+  }
+
+  return true;
+}
+
+static bool is_finished(const connection &conn) noexcept {
+  return conn.eof && conn.requests.empty() && conn.running.empty() &&
+         conn.output.empty();
+}
+
+static std::list<std::string> split(const std::string &str) {
+  std::list<std::string> retval;
+
+  const char *start = str.c_str();
+  do {
+    const char *found = strchr(start, DELIMITER);
+    if (found) {
+      retval.emplace_back(start, found++);
+    } else {
+      retval.emplace_back(start);
+    }
+
+    start = found;
+  } while (start);
+
+  return retval;
+}
+
+static std::vector<const char *>
+to_argv(const std::list<std::string> &string_list) {
+  std::vector<const char *> retval;
+  retval.reserve(string_list.size());
+
+  for (const std::string &str : string_list) {
+    retval.emplace_back(str.c_str());
+  }
+
+  return retval;
+}
+
+static void filter_range(hl::token_list &tokens,
+                         unsigned int    begin_line,
+                         unsigned int    end_line) {
+  auto out_of_range = [begin_line, end_line](const hl::token &tok) {
+    return tok.pos[0] < begin_line || (end_line != 0 && tok.pos[0] > end_line);
+  };
+  tokens.erase(std::remove_if(tokens.begin(), tokens.end(), out_of_range),
+               tokens.end());
+}
+
+static std::string request_slot(const std::string &buf_name, bool lexical) {
+  // '\0' can not be a part of buffer name
+  return lexical ? buf_name + '\0' + "lexical" : buf_name;
+}
+
+static hl::response make_response(const hl::request &req) {
+  hl::response resp;
+  resp.message_number = req.message_number;
+  resp.version        = req.version;
+  resp.id             = req.id;
+  resp.buf_type       = req.buf_type;
+  resp.buf_name       = req.buf_name;
+  resp.return_code    = 0;
+  resp.diff_mode      = req.diff_mode;
+  resp.is_diff        = false;
+  resp.shift_line     = 0;
+  resp.shift_rows     = 0;
+  resp.lexical_mode   = req.lexical_mode;
+  resp.lexical        = false;
+
+  return resp;
+}
+
+static hl::response process(const hl::request &        req,
+                           const worker_context &     context,
+                           const hl::cancel_callback &cancel,
+                           unit_info &                unit,
+                           disk_result &              stored) {
+  const hl::worker_options &options = context.options;
+
+  hl::response         resp = make_response(req);
+  std::string          err;
+  hl::tokenize_options tokenize_options;
+
+  hl::compile_flags_ptr     db_flags;
+  std::list<std::string>    args;
+  std::vector<const char *> argv;
+  std::string               key;
+  std::string               response_key;
+  uint64_t                  content_hash = 0;
+  hl::token_list_ptr        cached_tokens;
+  hl::file_stamp            dependencies;
+  bool full_range = req.begin_line == 0 && req.end_line == 0;
+  bool exceeded   = false;
+  bool degraded   = false;
+  bool lexical    = false;
+
+
+  if (req.buf_type != "cpp" && req.buf_type != "c") {
+    LOG_WARNING("not supported buffer type: %s", req.buf_type.c_str());
+
+    resp.return_code   = 1;
+    resp.error_message = "unsupported buffer type: " + req.buf_type;
+    goto Finish;
+  }
+
+
+  // tokenization, flags from compilation database are parsed only once, so
+  // they are same for all requests and translation units can be reused
+  if (context.compile_db != nullptr) {
+    db_flags = context.compile_db->get(req.buf_name);
+  }
+  if (db_flags) {
+    argv = db_flags->argv;
+  }
+  if (req.additional_info.empty() == false) {
+    args = split(req.additional_info);
+    std::vector<const char *> client_argv = to_argv(args);
+    argv.insert(argv.end(), client_argv.begin(), client_argv.end());
+  }
+  for (int i = 0; i < options.default_flags_count; ++i) {
+    argv.push_back(options.default_flags[i]);
+  }
+
+  // editors often send unchanged buffers, so tokens of latest responses are
+  // reused without parsing
+  key = hl::tu_cache::make_key(req.buf_name.c_str(), argv.size(), argv.data());
+  response_key  = key + '\0' + req.buf_type;
+  content_hash  = hl::hash_string(req.buf_body);
+  cached_tokens = context.responses.get(response_key, content_hash);
+  if (cached_tokens) {
+    LOG_DEBUG("tokens for %s got from response cache", req.buf_name.c_str());
+    hl::metrics::increment(hl::metrics::counter::response_cache_hits);
+
+    resp.tokens = *cached_tokens;
+    if (full_range == false) {
+      filter_range(resp.tokens, req.begin_line, req.end_line);
+    }
+    goto Finish;
+  }
+
+  // result from disk is used only if there is no translation unit for the
+  // buffer (usually after restart), because included headers could be changed
+  if (context.disk_cache != nullptr && context.cache.contains(key) == false &&
+      context.disk_cache->load(key, req.buf_body, resp.tokens)) {
+    LOG_DEBUG("tokens for %s loaded from disk cache", req.buf_name.c_str());
+    hl::metrics::increment(hl::metrics::counter::disk_cache_hits);
+
+    // included files of the result are unknown, so it is not put to response
+    // cache, loading from disk is cheap anyway
+    if (full_range == false) {
+      filter_range(resp.tokens, req.begin_line, req.end_line);
+    }
+    goto Finish;
+  }
+
+  tokenize_options.begin_line = req.begin_line;
+  tokenize_options.end_line   = req.end_line;
+  tokenize_options.cancel     = cancel;
+
+  // pathological buffers are tokenized lexically for some time, otherwise
+  // every request for them takes parse slot for whole budget. Clients, which
+  // can't recognize lexical response, get error instead
+  degraded = is_degraded(context.degraded, key);
+  if (degraded && req.lexical_mode == false) {
+    LOG_DEBUG("buffer %s is degraded", req.buf_name.c_str());
+
+    resp.return_code   = 6;
+    resp.error_message = "buffer exceeded budget of resources";
+    goto Finish;
+  }
+
+  lexical = req.lexical || degraded;
+  if (lexical == false) {
+    tokenize_options.incremental   = options.incremental;
+    tokenize_options.dependencies  = &dependencies;
+    tokenize_options.memory_budget = options.memory_budget;
+    tokenize_options.exceeded      = &exceeded;
+    // count of concurrent parses is limited for all workers, time in queue
+    // for parse slot is not counted
+    tokenize_options.background  = req.priority == hl::priority::background;
+    tokenize_options.time_budget = options.time_budget;
+    if (context.tracker != nullptr) {
+      unit.key = key;
+      unit.args.assign(argv.begin(), argv.end());
+      tokenize_options.includes = &unit.includes;
+    }
+
+    resp.tokens = hl::clang_tokenize(context.cache,
+                                     req.buf_name.c_str(),
+                                     req.buf_body,
+                                     argv.size(),
+                                     argv.data(),
+                                     err,
+                                     tokenize_options);
+  }
+  if (exceeded) {
+    LOG_WARNING("buffer %s exceeded budget: %s",
+                req.buf_name.c_str(),
+                err.c_str());
+    hl::metrics::increment(hl::metrics::counter::over_budget);
+    mark_degraded(context.degraded, key);
+
+    lexical  = req.lexical_mode;
+    exceeded = req.lexical_mode == false;
+    err.clear();
+  }
+
+  // lexical tokenization doesn't parse included files, so it is fast, but
+  // the buffer itself can be pathological, so it is limited same way
+  if (lexical) {
+    LOG_DEBUG("lexical tokenization of %s", req.buf_name.c_str());
+
+    tokenize_options.memory_budget = options.memory_budget;
+    tokenize_options.exceeded      = &exceeded;
+    tokenize_options.background    = req.priority == hl::priority::background;
+    tokenize_options.time_budget   = options.time_budget;
+
+    resp.lexical = true;
+    resp.tokens  = hl::clang_tokenize_lexical(context.cache,
+                                             req.buf_name.c_str(),
+                                             req.buf_body,
+                                             argv.size(),
+                                             argv.data(),
+                                             err,
+                                             tokenize_options);
+  }
+  if (exceeded) {
+    if (lexical) {
+      LOG_WARNING("lexical tokenization of %s exceeded budget",
+                  req.buf_name.c_str());
+      hl::metrics::increment(hl::metrics::counter::over_budget);
+    }
+
+    resp.return_code   = 6;
+    resp.error_message = "buffer exceeded budget of resources";
+    resp.tokens.clear();
+    goto Finish;
+  }
+  if (err.empty() == false) {
+    LOG_ERROR("error from tokenizer: %s", err.c_str());
+
+    resp.return_code   = 4;
+    resp.error_message = "error from tokenizer: " + err;
+    goto Finish;
+  }
+
+  // results of lexical tokenization are not stored, so next request for same
+  // content gets complete result
+  if (lexical) {
+    goto Finish;
+  }
+
+  // only results for whole buffer are stored
+  if (full_range) {
+    stored.tokens = std::make_shared<const hl::token_list>(resp.tokens);
+    context.responses.put(
+        response_key,
+        content_hash,
+        stored.tokens,
+        std::make_shared<const hl::file_stamp>(std::move(dependencies)));
+  }
+  if (context.disk_cache != nullptr && full_range) {
+    stored.key = key;
+  }
+
+
+Finish:
+  return resp;
+}
+
+static bool is_degraded(degraded_units &units, const std::string &key) {
+  std::lock_guard<std::mutex> lock{units.mutex};
+  auto                        found = units.keys.find(key);
+  if (found == units.keys.end()) {
+    return false;
+  }
+
+  if (std::chrono::steady_clock::now() - found->second > DEGRADED_TIMEOUT) {
+    units.keys.erase(found);
+    return false;
+  }
+
+  return true;
+}
+
+static void mark_degraded(degraded_units &units, const std::string &key) {
+  std::lock_guard<std::mutex> lock{units.mutex};
+  units.keys[key] = std::chrono::steady_clock::now();
+}